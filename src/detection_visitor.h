@@ -0,0 +1,27 @@
+#ifndef DETECTION_VISITOR_H_
+#define DETECTION_VISITOR_H_
+
+class Arc;
+class Circle;
+class EdgeSegment;
+class Ellipse;
+class Line;
+
+// Walks the results of a detector without copying them. Each Visit* call
+// receives a reference into the detector's published results, which stay
+// valid until the next detection call finishes; the default implementations
+// ignore the result.
+class DetectionVisitor {
+ public:
+  virtual ~DetectionVisitor() {}
+
+ public:
+  virtual void VisitEdgeSegment(const EdgeSegment&) {}
+  virtual void VisitLine(const Line&) {}
+  virtual void VisitArc(const Arc&) {}
+  virtual void VisitExtendedArc(const Arc&) {}
+  virtual void VisitCircle(const Circle&) {}
+  virtual void VisitEllipse(const Ellipse&) {}
+};
+
+#endif
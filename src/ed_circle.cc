@@ -3,6 +3,9 @@
 #define _USE_MATH_DEFINES
 #include <math.h>
 
+#include <algorithm>
+
+#include "fast_math.h"
 #include "primitives/circle.h"
 #include "primitives/line.h"
 #include "util.h"
@@ -15,8 +18,8 @@ EDCircle::EDCircle() {
   arc_line_angle_thresholds_[1] = 60.0f / 180.0f * M_PI;
 }
 
-void EDCircle::DetectCircle(GrayImage& image) {
-  DetectEdge(image);
+void EDCircle::DetectCircle(GrayImageView image) {
+  DetectEdgeSegments(image);
 
   STOPWATCHSTART(verbose_)
   DetectCircleAndEllipseFromClosedEdgeSegment();
@@ -35,70 +38,118 @@ void EDCircle::DetectCircle(GrayImage& image) {
   ExtendArcsAndDetectEllipse();
   STOPWATCHSTOP(verbose_, "EDCircle::ExtendArcsAndDetectEllipse - ")
 
+  GrayImageView validation_image =
+      gaussian_size_ > 0 ? GrayImageView(smoothed_image_) : image;
+
   STOPWATCHSTART(verbose_)
-  ValidateCircleAndEllipse(image);
+  ValidateCircleAndEllipse(validation_image);
   STOPWATCHSTOP(verbose_, "EDCircle::ValidateCircleAndEllipse - ")
+
+  PublishEdgeSegments();
+  PublishLines();
+  PublishCircles();
 }
 
-std::list<Circle> EDCircle::circles() { return circles_; }
+const std::vector<Circle>& EDCircle::circles() const {
+  return published_circles_;
+}
 
-std::list<Ellipse> EDCircle::ellipses() { return ellipses_; }
+const std::vector<Ellipse>& EDCircle::ellipses() const {
+  return published_ellipses_;
+}
+
+const std::vector<Arc>& EDCircle::arcs() const { return published_arcs_; }
 
-std::list<Arc> EDCircle::arcs() { return arcs_; }
+const std::vector<Arc>& EDCircle::extended_arcs() const {
+  return published_extended_arcs_;
+}
 
-std::list<Arc> EDCircle::extended_arcs() { return extended_arcs_; }
+void EDCircle::Accept(DetectionVisitor& visitor) const {
+  EDLine::Accept(visitor);
+  for (const auto& arc : published_arcs_) {
+    visitor.VisitArc(arc);
+  }
+  for (const auto& arc : published_extended_arcs_) {
+    visitor.VisitExtendedArc(arc);
+  }
+  for (const auto& circle : published_circles_) {
+    visitor.VisitCircle(circle);
+  }
+  for (const auto& ellipse : published_ellipses_) {
+    visitor.VisitEllipse(ellipse);
+  }
+}
+
+// The arcs point at their line store, so after the swap they are moved over
+// to the published stores.
+void EDCircle::PublishCircles() {
+  published_circles_.swap(circles_);
+  published_ellipses_.swap(ellipses_);
+  published_arcs_.swap(arcs_);
+  published_extended_arcs_.swap(extended_arcs_);
+  published_extended_arc_lines_.swap(extended_arc_lines_);
+
+  for (auto& arc : published_arcs_) {
+    arc.Rebind(lines_, published_lines_);
+    arc.Rebind(extended_arc_lines_, published_extended_arc_lines_);
+  }
+  for (auto& arc : published_extended_arcs_) {
+    arc.Rebind(lines_, published_lines_);
+    arc.Rebind(extended_arc_lines_, published_extended_arc_lines_);
+  }
+}
 
 void EDCircle::DetectCircleAndEllipseFromClosedEdgeSegment() {
   not_closed_edge_segmnets_.clear();
   circles_.clear();
   ellipses_.clear();
 
-  not_closed_edge_segmnets_.insert(not_closed_edge_segmnets_.end(),
-                                   edge_segments_.begin(),
-                                   edge_segments_.end());
-
-  for (auto edge_it = not_closed_edge_segmnets_.begin();
-       edge_it != not_closed_edge_segmnets_.end();) {
-    if (edge_it->isClosed() == true) {
-      Circle circle = Circle::FitFromEdgeSegment(*edge_it);
+  for (const auto& edge_segment : edge_segments_) {
+    if (edge_segment.isClosed() == true) {
+      Circle circle = Circle::FitFromEdgeSegment(edge_segment);
 
       if (circle.fitting_error() < circle_fitting_error_threshold_) {
         circles_.push_back(circle);
-        edge_it = not_closed_edge_segmnets_.erase(edge_it);
         continue;
       }
 
-      Ellipse ellipse = Ellipse::FitFromEdgeSegment(*edge_it);
+      Ellipse ellipse = Ellipse::FitFromEdgeSegment(edge_segment);
 
       if (ellipse.fitting_error() < ellipse_fitting_error_threshold_) {
         ellipses_.push_back(ellipse);
-        edge_it = not_closed_edge_segmnets_.erase(edge_it);
         continue;
       }
     }
-    edge_it++;
+
+    not_closed_edge_segmnets_.push_back(edge_segment);
   }
 }
 
-std::vector<std::vector<Line>> EDCircle::ExtractArcCandidates(
-    const std::vector<Line>& lines) {
-  std::vector<std::vector<Line>> arc_candidates;
-
-  std::vector<float> lengths;
-  std::vector<float> angles;
-  std::vector<unsigned char> turn_directions;
-
-  lengths.reserve(lines.size());
-  angles.reserve(lines.size());
-  turn_directions.reserve(lines.size());
-
-  if (lines.size() < 3) {
-    return arc_candidates;
+// Splits lines_[first_line, last_line), the lines of one segment, into runs
+// turning the same way by moderate angles, and keeps those of three lines or
+// more in arc_candidates_.
+void EDCircle::ExtractArcCandidates(std::size_t first_line,
+                                    std::size_t last_line) {
+  std::vector<float>& lengths = line_lengths_;
+  std::vector<float>& angles = line_angles_;
+  std::vector<unsigned char>& turn_directions = turn_directions_;
+
+  arc_candidates_.clear();
+  lengths.clear();
+  angles.clear();
+  turn_directions.clear();
+
+  const Line* lines = lines_.data() + first_line;
+  const Line* lines_end = lines_.data() + last_line;
+  std::size_t line_count = last_line - first_line;
+
+  if (line_count < 3) {
+    return;
   }
 
   lengths.push_back(lines[0].length());
 
-  for (auto i = 1; i < lines.size(); ++i) {
+  for (auto i = 1; i < line_count; ++i) {
     lengths.push_back(lines[i].length());
 
     Position prev_vector = lines[i - 1].line_vector();
@@ -106,13 +157,13 @@ std::vector<std::vector<Line>> EDCircle::ExtractArcCandidates(
 
     float dot_product =
         float(prev_vector.x * cur_vector.x + prev_vector.y * cur_vector.y);
-    float angle = acos(dot_product / (lengths[i - 1] * lengths[i]));
-
-    float cross_product = asin(
+    float cross_product =
         float(prev_vector.x * cur_vector.y - prev_vector.y * cur_vector.x) /
-        (lengths[i - 1] * lengths[i]));
+        (lengths[i - 1] * lengths[i]);
 
-    angles.push_back(angle);
+    // Cosines for now, turned into angles in one batch below. Only the sign
+    // of the cross product matters, which asin keeps.
+    angles.push_back(dot_product / (lengths[i - 1] * lengths[i]));
 
     if (cross_product >= 0.0f) {
       turn_directions.push_back(-1);
@@ -121,13 +172,15 @@ std::vector<std::vector<Line>> EDCircle::ExtractArcCandidates(
     }
   }
 
+  FastMath::Acos(angles.data(), angles.data(), angles.size());
+
   unsigned char current_turn_direction = turn_directions[0];
-  auto candidnate_begin = lines.begin();
-  auto candidnate_end = lines.begin() + 1;
+  const Line* candidnate_begin = lines;
+  const Line* candidnate_end = lines + 1;
 
   int info_index = 0;
-  while (candidnate_begin != lines.end()) {
-    if (candidnate_end != lines.end() &&
+  while (candidnate_begin != lines_end) {
+    if (candidnate_end != lines_end &&
         arc_line_angle_thresholds_[0] < angles[info_index] &&
         angles[info_index] < arc_line_angle_thresholds_[1] &&
         current_turn_direction == turn_directions[info_index]) {
@@ -137,7 +190,7 @@ std::vector<std::vector<Line>> EDCircle::ExtractArcCandidates(
     }
 
     if (candidnate_end - candidnate_begin < 3) {
-      if (candidnate_end == lines.end()) {
+      if (candidnate_end == lines_end) {
         break;
       }
 
@@ -145,16 +198,16 @@ std::vector<std::vector<Line>> EDCircle::ExtractArcCandidates(
 
       candidnate_begin++;
       candidnate_end = candidnate_begin + 1;
-      info_index = std::distance(lines.begin(), candidnate_begin);
+      info_index = int(candidnate_begin - lines);
 
       continue;
     }
 
-    std::vector<Line> candidate;
-    candidate.insert(candidate.end(), candidnate_begin, candidnate_end);
-    arc_candidates.push_back(candidate);
+    arc_candidates_.push_back(
+        LineRange{first_line + (candidnate_begin - lines),
+                  first_line + (candidnate_end - lines)});
 
-    if (candidnate_end == lines.end()) {
+    if (candidnate_end == lines_end) {
       break;
     }
 
@@ -163,19 +216,33 @@ std::vector<std::vector<Line>> EDCircle::ExtractArcCandidates(
     candidnate_end++;
     info_index++;
   }
+}
 
-  return arc_candidates;
+namespace {
+
+// Stable like std::list::sort but without the buffer std::stable_sort
+// allocates. The arc lists are short and the merging that follows is
+// quadratic in them anyway.
+template <typename Less>
+void StableInsertionSort(std::vector<Arc>& arcs, Less less) {
+  for (auto it = arcs.begin(); it != arcs.end(); ++it) {
+    std::rotate(std::upper_bound(arcs.begin(), it, *it, less), it, it + 1);
+  }
 }
 
+}  // namespace
+
 void EDCircle::ExtendArcsAndDetectCircle() {
   const float kThresholdRatio = 0.25f;
 
-  std::list<Arc> candidates;
-  candidates.insert(candidates.end(), arcs_.begin(), arcs_.end());
-  candidates.sort(
-      [](const Arc& a, const Arc& b) { return a.length() > b.length(); });
+  std::vector<Arc>& candidates = candidate_arcs_;
+  candidates.assign(arcs_.begin(), arcs_.end());
+  StableInsertionSort(candidates, [](const Arc& a, const Arc& b) {
+    return a.length() > b.length();
+  });
 
-  std::list<Arc> extended_arcs;
+  std::vector<Arc>& extended_arcs = next_extended_arcs_;
+  extended_arcs.clear();
 
   while (candidates.empty() != true) {
     Arc target_arc = candidates.front();
@@ -184,58 +251,80 @@ void EDCircle::ExtendArcsAndDetectCircle() {
     float target_radius = target_arc.fitted_circle().get_radius();
     float threashold = target_radius * kThresholdRatio;
 
-    candidates.pop_front();
+    std::vector<Arc>& extended_candidates = neighbor_arcs_;
+    extended_candidates.clear();
 
-    std::list<Arc> extended_candidates;
-
-    for (auto& it = candidates.begin(); it != candidates.end();) {
-      PositionF center = it->fitted_circle().get_center();
-      float radius = it->fitted_circle().get_radius();
+    // Drops the target from the front and moves its neighbours out, keeping
+    // the order of the rest.
+    std::size_t kept = 0;
+    for (std::size_t i = 1; i < candidates.size(); ++i) {
+      const Arc& candidate = candidates[i];
+      PositionF center = candidate.fitted_circle().get_center();
+      float radius = candidate.fitted_circle().get_radius();
       float center_distance = target_center.DistanceWith(center);
 
       if (abs(radius - target_radius) <= threashold &&
           center_distance <= threashold) {
-        extended_candidates.push_back(*it);
-        it = candidates.erase(it);
+        extended_candidates.push_back(candidate);
         continue;
       }
-      it++;
+      candidates[kept++] = candidate;
     }
+    candidates.erase(candidates.begin() + kept, candidates.end());
+
+    StableInsertionSort(
+        extended_candidates, [&target_arc](const Arc& a, const Arc& b) {
+          float distance_a = a.ComputeNearestDistanceWithEndPoint(target_arc);
+          float distance_b = b.ComputeNearestDistanceWithEndPoint(target_arc);
+
+          return distance_a < distance_b;
+        });
+
+    // Merges are tried on the arcs' moments; only the extended arc that
+    // results is measured against its pixels.
+    std::vector<Line>& extended_lines = extended_lines_;
+    extended_lines.assign(target_arc.begin(), target_arc.end());
+    ConicFitter extended_fitter = target_arc.fitter();
+    std::vector<Arc>& merged_arcs = merged_arcs_;
+    merged_arcs.clear();
+
+    kept = 0;
+    for (std::size_t i = 0; i < extended_candidates.size(); ++i) {
+      const Arc& candidate = extended_candidates[i];
+      ConicFitter merged_fitter = extended_fitter;
+      merged_fitter.Add(candidate.fitter());
+
+      if (merged_fitter.circle_fitting_error() <= 1.5f) {
+        extended_lines.insert(extended_lines.end(), candidate.begin(),
+                              candidate.end());
+        extended_fitter = merged_fitter;
+        merged_arcs.push_back(candidate);
 
-    extended_candidates.sort([target_arc](const Arc& a, const Arc& b) {
-      float distance_a = a.ComputeNearestDistanceWithEndPoint(target_arc);
-      float distance_b = b.ComputeNearestDistanceWithEndPoint(target_arc);
-
-      return distance_a < distance_b;
-    });
-
-    auto extended_lines = target_arc.lines();
-    bool is_extended = false;
-
-    for (auto it = extended_candidates.begin();
-         it != extended_candidates.end();) {
-      std::vector<Line> new_lines = extended_lines;
-      std::vector<Line> candidate_lines = it->lines();
-      new_lines.insert(new_lines.end(), candidate_lines.begin(),
-                       candidate_lines.end());
+        continue;
+      }
 
-      Circle circle = Circle::FitFromLines(new_lines);
+      extended_candidates[kept++] = candidate;
+    }
+    extended_candidates.erase(extended_candidates.begin() + kept,
+                              extended_candidates.end());
 
-      if (circle.fitting_error() <= 1.5f) {
-        extended_lines = new_lines;
+    Arc arc = target_arc;
 
-        it = extended_candidates.erase(it);
-        is_extended = true;
+    // The estimate runs below the exact error, so the extended arc has to
+    // pass the test again; otherwise the merged arcs go back to the
+    // candidates and the target arc is tried alone.
+    if (merged_arcs.empty() != true) {
+      Arc extended_arc = StoreExtendedArc(extended_lines, extended_fitter);
 
-        continue;
+      if (extended_arc.fitted_circle().fitting_error() <= 1.5f) {
+        arc = extended_arc;
+      } else {
+        extended_candidates.insert(extended_candidates.end(),
+                                   merged_arcs.begin(), merged_arcs.end());
       }
-
-      it++;
     }
 
-    if (is_extended == true) {
-      Arc arc(extended_lines);
-
+    if (arc.fitted_circle().fitting_error() <= 1.5f) {
       float length = arc.length();
       float circumference = 2.0f * arc.fitted_circle().get_radius() * M_PI;
 
@@ -244,38 +333,26 @@ void EDCircle::ExtendArcsAndDetectCircle() {
       } else {
         extended_arcs.push_back(arc);
       }
-    } else {
-      Arc arc(extended_lines);
-
-      if (arc.fitted_circle().fitting_error() <= 1.5f) {
-        float length = arc.length();
-        float circumference = 2.0f * arc.fitted_circle().get_radius() * M_PI;
-
-        if (length > circumference * 0.5f) {
-          circles_.push_back(arc.fitted_circle());
-        } else {
-          extended_arcs.push_back(arc);
-        }
-      }
     }
 
     candidates.insert(candidates.end(), extended_candidates.begin(),
                       extended_candidates.end());
   }
 
-  extended_arcs_ = extended_arcs;
+  extended_arcs_.swap(extended_arcs);
 }
 
 void EDCircle::ExtendArcsAndDetectEllipse() {
   const float kThresholdRatio = 0.5f;
 
-  std::list<Arc> candidates;
-  candidates.insert(candidates.end(), extended_arcs_.begin(),
-                    extended_arcs_.end());
-  candidates.sort(
-      [](const Arc& a, const Arc& b) { return a.length() > b.length(); });
+  std::vector<Arc>& candidates = candidate_arcs_;
+  candidates.assign(extended_arcs_.begin(), extended_arcs_.end());
+  StableInsertionSort(candidates, [](const Arc& a, const Arc& b) {
+    return a.length() > b.length();
+  });
 
-  std::list<Arc> extended_arcs;
+  std::vector<Arc>& extended_arcs = next_extended_arcs_;
+  extended_arcs.clear();
 
   while (candidates.empty() != true) {
     Arc target_arc = candidates.front();
@@ -284,72 +361,90 @@ void EDCircle::ExtendArcsAndDetectEllipse() {
     float target_radius = target_arc.fitted_circle().get_radius();
     float threashold = target_radius * kThresholdRatio;
 
-    candidates.pop_front();
+    std::vector<Arc>& extended_candidates = neighbor_arcs_;
+    extended_candidates.clear();
 
-    std::list<Arc> extended_candidates;
-
-    for (auto& it = candidates.begin(); it != candidates.end();) {
-      PositionF center = it->fitted_circle().get_center();
-      float radius = it->fitted_circle().get_radius();
+    // Drops the target from the front and moves its neighbours out, keeping
+    // the order of the rest.
+    std::size_t kept = 0;
+    for (std::size_t i = 1; i < candidates.size(); ++i) {
+      const Arc& candidate = candidates[i];
+      PositionF center = candidate.fitted_circle().get_center();
+      float radius = candidate.fitted_circle().get_radius();
       float center_distance = target_center.DistanceWith(center);
 
       if (abs(radius - target_radius) <= threashold &&
           center_distance <= threashold) {
-        extended_candidates.push_back(*it);
-        it = candidates.erase(it);
+        extended_candidates.push_back(candidate);
         continue;
       }
-      it++;
+      candidates[kept++] = candidate;
     }
-
-    extended_candidates.sort([target_arc](const Arc& a, const Arc& b) {
-      float distance_a = a.ComputeNearestDistanceWithEndPoint(target_arc);
-      float distance_b = b.ComputeNearestDistanceWithEndPoint(target_arc);
-
-      return distance_a < distance_b;
-    });
-
-    auto extended_lines = target_arc.lines();
-    int extended_count = 0;
-
-    for (auto it = extended_candidates.begin();
-         it != extended_candidates.end();) {
-      std::vector<Line> new_lines = extended_lines;
-      std::vector<Line> candidate_lines = it->lines();
-      new_lines.insert(new_lines.end(), candidate_lines.begin(),
-                       candidate_lines.end());
-
-      Ellipse ellipse = Ellipse::FitFromLines(new_lines);
-
-      if (ellipse.fitting_error() <= 1.5f) {
-        extended_lines = new_lines;
-
-        it = extended_candidates.erase(it);
-        extended_count++;
+    candidates.erase(candidates.begin() + kept, candidates.end());
+
+    StableInsertionSort(
+        extended_candidates, [&target_arc](const Arc& a, const Arc& b) {
+          float distance_a = a.ComputeNearestDistanceWithEndPoint(target_arc);
+          float distance_b = b.ComputeNearestDistanceWithEndPoint(target_arc);
+
+          return distance_a < distance_b;
+        });
+
+    // As for circles, merges are tried on the arcs' moments.
+    std::vector<Line>& extended_lines = extended_lines_;
+    extended_lines.assign(target_arc.begin(), target_arc.end());
+    ConicFitter extended_fitter = target_arc.fitter();
+    std::vector<Arc>& merged_arcs = merged_arcs_;
+    merged_arcs.clear();
+
+    kept = 0;
+    for (std::size_t i = 0; i < extended_candidates.size(); ++i) {
+      const Arc& candidate = extended_candidates[i];
+      ConicFitter merged_fitter = extended_fitter;
+      merged_fitter.Add(candidate.fitter());
+
+      if (merged_fitter.ellipse_fitting_error() <= 1.5f) {
+        extended_lines.insert(extended_lines.end(), candidate.begin(),
+                              candidate.end());
+        extended_fitter = merged_fitter;
+        merged_arcs.push_back(candidate);
 
         continue;
       }
 
-      it++;
+      extended_candidates[kept++] = candidate;
     }
+    extended_candidates.erase(extended_candidates.begin() + kept,
+                              extended_candidates.end());
+
+    bool is_extended = false;
 
-    if (extended_count > 0) {
-      Arc arc(extended_lines);
+    // As for circles, the extended arc has to pass the exact error test;
+    // otherwise the merged arcs go back to the candidates.
+    if (merged_arcs.empty() != true) {
+      Arc arc = StoreExtendedArc(extended_lines, extended_fitter);
 
-      Ellipse ellipse = Ellipse::FitFromLines(extended_lines);
+      Ellipse ellipse = arc.fitter().FitEllipse(arc.begin(), arc.end());
 
-      float length = arc.length();
-      float circumference = ellipse.get_circumference();
+      if (ellipse.fitting_error() <= 1.5f) {
+        float length = arc.length();
+        float circumference = ellipse.get_circumference();
 
-      if (length > circumference * 0.5f) {
-        ellipses_.push_back(ellipse);
+        if (length > circumference * 0.5f) {
+          ellipses_.push_back(ellipse);
+        } else {
+          extended_arcs.push_back(arc);
+        }
+        is_extended = true;
       } else {
-        Arc arc(extended_lines);
-        extended_arcs.push_back(arc);
+        extended_candidates.insert(extended_candidates.end(),
+                                   merged_arcs.begin(), merged_arcs.end());
       }
-    } else {
-      Arc arc(extended_lines);
-      Ellipse ellipse = Ellipse::FitFromLines(extended_lines);
+    }
+
+    if (is_extended != true) {
+      const Arc& arc = target_arc;
+      Ellipse ellipse = arc.fitter().FitEllipse(arc.begin(), arc.end());
 
       if (ellipse.fitting_error() <= 1.5f) {
         float length = arc.length();
@@ -367,37 +462,43 @@ void EDCircle::ExtendArcsAndDetectEllipse() {
                       extended_candidates.end());
   }
 
-  extended_arcs_ = extended_arcs;
+  extended_arcs_.swap(extended_arcs);
 }
 
-void EDCircle::ValidateCircleAndEllipse(GrayImage &image) {
-  std::list<Circle> circles;
+void EDCircle::ValidateCircleAndEllipse(GrayImageView image) {
+  // N = (sqrt(width * height))^5 candidate circles and ellipses.
+  double image_size = double(width_) * double(height_);
+  double diagonal = sqrt(double(width_ * width_ + height_ * height_));
+  circle_nfa_.Reset(precision_, 2.5 * log(image_size), int(diagonal));
+
+  std::size_t valid_count = 0;
 
-  for (const auto& c : circles_) {
-    if (IsValidCircle(c, image) == true) {
-      circles.push_back(c);
+  for (std::size_t i = 0; i < circles_.size(); i++) {
+    if (IsValidCircle(circles_[i], image) == true) {
+      circles_[valid_count++] = circles_[i];
     }
   }
 
-  circles_ = circles;
+  circles_.erase(circles_.begin() + valid_count, circles_.end());
 
-  std::list<Ellipse> ellipses;
+  valid_count = 0;
 
-  for (const auto& e : ellipses_) {
-    if (IsValidEllipse(e, image) == true) {
-      ellipses.push_back(e);
+  for (std::size_t i = 0; i < ellipses_.size(); i++) {
+    if (IsValidEllipse(ellipses_[i], image) == true) {
+      ellipses_[valid_count++] = ellipses_[i];
     }
   }
 
-  ellipses_ = ellipses;
+  ellipses_.erase(ellipses_.begin() + valid_count, ellipses_.end());
 }
 
-bool EDCircle::IsValidCircle(const Circle& circle, GrayImage &image) {
-  float circumference = circle.get_circumference();
+bool EDCircle::IsValidCircle(const Circle& circle, GrayImageView image) {
   float degree_step = 1.0f;
 
-  std::vector<Position> positions;
-  positions.reserve(int(ceil(circumference)));
+  std::vector<Position>& positions = sample_positions_;
+  positions.clear();
+
+  sample_orientations_.clear();
 
   Position prev_p(-1, -1);
   for (float degree = 0.0f; degree < 360.0f; degree += degree_step) {
@@ -409,33 +510,48 @@ bool EDCircle::IsValidCircle(const Circle& circle, GrayImage &image) {
     if (p.x != prev_p.x && p.y != prev_p.y) {
       positions.push_back(p);
       prev_p = p;
+
+      if (orientation_map_enabled_ == true) {
+        // The tangent at degree d points along d + 90.
+        int tangent =
+            int(lround((degree + 90.0f) / 180.0f * kOrientationUnits));
+        sample_orientations_.push_back(
+            (unsigned char)(tangent & (kOrientationUnits - 1)));
+      }
     }
   }
 
   PositionF center = circle.get_center();
 
   int circumference_length = int(positions.size());
+
+  if (orientation_map_enabled_ == true) {
+    return circle_nfa_.IsMeaningful(circumference_length,
+                                    CountAlignedSamples(positions));
+  }
+
   int aligned_count = 0;
 
   unsigned char* buffer = image.buffer();
+  std::size_t stride = image.stride();
 
   for (auto p : positions) {
-    int offset = p.y * width_ + p.x;
+    std::size_t offset = p.y * stride + p.x;
 
     int p00 = int(buffer[offset]);
     int p01 = int(buffer[offset + 1]);
-    int p10 = int(buffer[offset + width_]);
-    int p11 = int(buffer[offset + width_ + 1]);
+    int p10 = int(buffer[offset + stride]);
+    int p11 = int(buffer[offset + stride + 1]);
 
     float gx = (p01 - p00 + p11 - p10) / 2.0f;
     float gy = (p10 - p00 + p11 - p01) / 2.0f;
 
     PositionF point_vector(p.x - center.x, p.y - center.y);
 
-    float tangent1 = atan2(gy, gx);
-    float tangent2 = atan2(-gy, -gx);
+    float tangent1 = FastMath::Atan2(gy, gx);
+    float tangent2 = FastMath::Atan2(-gy, -gx);
 
-    float level_line_angle = atan2(point_vector.y, point_vector.x);
+    float level_line_angle = FastMath::Atan2(point_vector.y, point_vector.x);
     float angle_diff = std::min(abs(tangent1 - level_line_angle),
                                 abs(tangent2 - level_line_angle));
 
@@ -444,21 +560,16 @@ bool EDCircle::IsValidCircle(const Circle& circle, GrayImage &image) {
     }
   }
 
-  float nfa = getCircleNFA(circumference_length, aligned_count);
-
-  if (nfa <= 1.0f) {
-    return true;
-  } else {
-    return false;
-  }
+  return circle_nfa_.IsMeaningful(circumference_length, aligned_count);
 }
 
-bool EDCircle::IsValidEllipse(const Ellipse& ellipse, GrayImage& image) {
-  float circumference = ellipse.get_circumference();
+bool EDCircle::IsValidEllipse(const Ellipse& ellipse, GrayImageView image) {
   float degree_step = 1.0;
 
-  std::vector<Position> positions;
-  positions.reserve(int(ceil(circumference)));
+  std::vector<Position>& positions = sample_positions_;
+  positions.clear();
+
+  sample_orientations_.clear();
 
   Position prev_p(-1, -1);
   for (float degree = 0.0f; degree < 360.0f; degree += degree_step) {
@@ -470,40 +581,56 @@ bool EDCircle::IsValidEllipse(const Ellipse& ellipse, GrayImage& image) {
     if (p.x != prev_p.x && p.y != prev_p.y) {
       positions.push_back(p);
       prev_p = p;
+
+      if (orientation_map_enabled_ == true) {
+        PositionF tangent = ellipse.get_tangentAt(degree);
+        sample_orientations_.push_back(
+            QuantizeOrientation(tangent.x, tangent.y));
+      }
     }
   }
 
   PositionF center = ellipse.get_center();
 
   int circumference_length = int(positions.size());
+
+  if (orientation_map_enabled_ == true) {
+    return circle_nfa_.IsMeaningful(circumference_length,
+                                    CountAlignedSamples(positions));
+  }
+
   int aligned_count = 0;
 
   unsigned char* buffer = image.buffer();
+  std::size_t stride = image.stride();
 
   for (auto p : positions) {
-    int offset = p.y * width_ + p.x;
+    std::size_t offset = p.y * stride + p.x;
 
     int p00 = int(buffer[offset]);
     int p01 = int(buffer[offset + 1]);
-    int p10 = int(buffer[offset + width_]);
-    int p11 = int(buffer[offset + width_ + 1]);
+    int p10 = int(buffer[offset + stride]);
+    int p11 = int(buffer[offset + stride + 1]);
 
     float gx = (p01 - p00 + p11 - p10) / 2.0f;
     float gy = (p10 - p00 + p11 - p01) / 2.0f;
 
     PositionF point_vector(p.x - center.x, p.y - center.y);
-    float level_line_angle = atan2(point_vector.y, point_vector.x);
+    float level_line_angle = FastMath::Atan2(point_vector.y, point_vector.x);
     float ellipse_angle = ellipse.angle();
 
-    float new_aspect_x =
-        cos(level_line_angle - ellipse_angle) / ellipse.major_length();
-    float new_aspect_y =
-        sin(level_line_angle - ellipse_angle) / ellipse.minor_length();
+    float sin_angle = 0.0f;
+    float cos_angle = 0.0f;
+    FastMath::SinCos(level_line_angle - ellipse_angle, sin_angle, cos_angle);
 
-    level_line_angle = atan2(new_aspect_y, new_aspect_x) + ellipse_angle;
+    float new_aspect_x = cos_angle / ellipse.major_length();
+    float new_aspect_y = sin_angle / ellipse.minor_length();
 
-    float tangent1 = atan2(gy, gx);
-    float tangent2 = atan2(-gy, -gx);
+    level_line_angle =
+        FastMath::Atan2(new_aspect_y, new_aspect_x) + ellipse_angle;
+
+    float tangent1 = FastMath::Atan2(gy, gx);
+    float tangent2 = FastMath::Atan2(-gy, -gx);
 
     float angle_diff = std::min(abs(tangent1 - level_line_angle),
                                 abs(tangent2 - level_line_angle));
@@ -513,42 +640,25 @@ bool EDCircle::IsValidEllipse(const Ellipse& ellipse, GrayImage& image) {
     }
   }
 
-  float nfa = getCircleNFA(circumference_length, aligned_count);
-
-  if (nfa <= 1.0f) {
-    return true;
-  } else {
-    return false;
-  }
+  return circle_nfa_.IsMeaningful(circumference_length, aligned_count);
 }
 
-float EDCircle::getCircleNFA(int circumference_length, int aligned_count) {
-  double N = pow(sqrt(width_ * height_), 5.0);
-
-  double factorial = 0.0f;
-  for (auto i = aligned_count; i <= circumference_length; ++i) {
-    int diff1 = circumference_length - i;
-    int diff2 = circumference_length - diff1;
-    int bigger_diff = std::max(diff1, diff2);
-    int smaller_diff = std::min(diff1, diff2);
-
-    double _f = 0.0f;
+// Counts the samples whose level line in orientation_map_ is within pi / 8 of
+// the curve tangent in sample_orientations_.
+int EDCircle::CountAlignedSamples(const std::vector<Position>& positions) {
+  const unsigned char* orientations = orientation_map_.buffer();
+  int threshold = kOrientationUnits / 8;
+  int aligned_count = 0;
 
-    for (auto n = bigger_diff + 1; n <= circumference_length; ++n) {
-      _f += log(n);
-    }
-    for (auto n = 2; n <= smaller_diff; ++n) {
-      _f -= log(n);
+  for (std::size_t i = 0; i < positions.size(); ++i) {
+    unsigned char orientation = orientations[get_offset(positions[i])];
+    if (OrientationDifference(orientation, sample_orientations_[i]) <=
+        threshold) {
+      aligned_count++;
     }
-
-    _f += log(pow(precision_, double(i)) *
-              pow(1.0f - precision_, double(circumference_length - i)));
-
-    _f = exp(_f);
-    factorial += _f;
   }
 
-  return N * factorial;
+  return aligned_count;
 }
 
 void EDCircle::ExtractArcs() {
@@ -556,44 +666,39 @@ void EDCircle::ExtractArcs() {
       round(-4.0f * log(sqrt(float(width_) * float(height_))) / log(0.125f)));
 
   arcs_.clear();
+  lines_.clear();
+  extended_arc_lines_.clear();
 
   for (const auto& edge : not_closed_edge_segmnets_) {
-    std::vector<Line> lines = ExtractLinesFromEdgeSegment(edge);
-    lines_.insert(lines_.end(), lines.begin(), lines.end());
+    std::size_t first_line = lines_.size();
+    ExtractLinesFromEdgeSegment(edge, lines_);
+    ExtractArcCandidates(first_line, lines_.size());
 
-    std::vector<std::vector<Line>> arc_candidates = ExtractArcCandidates(lines);
+    const Line* lines = lines_.data();
 
-    for (const auto& candidate : arc_candidates) {
-      Circle circle = Circle::FitFromLines(candidate);
+    for (const auto& candidate : arc_candidates_) {
+      Circle circle =
+          Circle::FitFromLines(lines + candidate.begin, lines + candidate.end);
 
       if (circle.fitting_error() <= 1.5f) {
-        Arc arc(candidate);
-        arcs_.push_back(arc);
+        arcs_.push_back(Arc(lines_, candidate.begin, candidate.end));
         continue;
       }
 
-      auto search_begin = candidate.begin();
-      auto search_end = candidate.begin();
-      search_end += 3;
+      std::size_t search_begin = candidate.begin;
+      std::size_t search_end = candidate.begin + 3;
 
       bool is_found = false;
 
-      while (search_begin != candidate.end()) {
-        std::vector<Line> chunk_of_candidate;
-        chunk_of_candidate.insert(chunk_of_candidate.end(), search_begin,
-                                  search_end);
+      while (search_begin != candidate.end) {
+        Circle circle =
+            Circle::FitFromLines(lines + search_begin, lines + search_end);
 
-        Circle circle = Circle::FitFromLines(chunk_of_candidate);
-
-        if (circle.fitting_error() > 1.5f && chunk_of_candidate.size() >= 3) {
+        if (circle.fitting_error() > 1.5f && search_end - search_begin >= 3) {
           if (is_found == true) {
             search_end--;
 
-            std::vector<Line> new_arc_lines;
-            new_arc_lines.insert(new_arc_lines.end(), search_begin, search_end);
-
-            Arc arc(new_arc_lines);
-            arcs_.push_back(arc);
+            arcs_.push_back(Arc(lines_, search_begin, search_end));
 
             search_begin = search_end;
             is_found = false;
@@ -601,24 +706,19 @@ void EDCircle::ExtractArcs() {
           } else {
             search_begin++;
 
-            if (std::distance(search_begin, candidate.end()) < 3) {
+            if (candidate.end - search_begin < 3) {
               break;
             } else {
               is_found = false;
-              search_end = search_begin;
-              search_end += 3;
+              search_end = search_begin + 3;
               continue;
             }
           }
         }
 
-        if (search_end == candidate.end()) {
+        if (search_end == candidate.end) {
           if (circle.fitting_error() <= 1.5f) {
-            std::vector<Line> new_arc_lines;
-            new_arc_lines.insert(new_arc_lines.end(), search_begin, search_end);
-
-            Arc arc(new_arc_lines);
-            arcs_.push_back(arc);
+            arcs_.push_back(Arc(lines_, search_begin, search_end));
           }
 
           break;
@@ -629,3 +729,15 @@ void EDCircle::ExtractArcs() {
     }
   }
 }
+
+// Keeps the lines of an arc merged from several arcs in extended_arc_lines_,
+// which the returned arc refers to.
+Arc EDCircle::StoreExtendedArc(const std::vector<Line>& lines,
+                               const ConicFitter& fitter) {
+  std::size_t begin = extended_arc_lines_.size();
+  extended_arc_lines_.insert(extended_arc_lines_.end(), lines.begin(),
+                             lines.end());
+
+  return Arc(extended_arc_lines_, begin, extended_arc_lines_.size(),
+             fitter);
+}
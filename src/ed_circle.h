@@ -12,36 +12,66 @@ class EDCircle : public EDLine {
   EDCircle();
 
  public:
-  void DetectCircle(GrayImage& image);
+  void DetectCircle(GrayImageView image);
 
-  std::list<Circle> circles();
-  std::list<Ellipse> ellipses();
-  std::list<Arc> arcs();
-  std::list<Arc> extended_arcs();
+  const std::vector<Circle>& circles() const;
+  const std::vector<Ellipse>& ellipses() const;
+  const std::vector<Arc>& arcs() const;
+  const std::vector<Arc>& extended_arcs() const;
+  void Accept(DetectionVisitor& visitor) const override;
 
  protected:
+  void PublishCircles();
   void DetectCircleAndEllipseFromClosedEdgeSegment();
   void ExtractArcs();
-  std::vector<std::vector<Line>> ExtractArcCandidates(
-      const std::vector<Line>& line_segments);
+  void ExtractArcCandidates(std::size_t first_line, std::size_t last_line);
+  Arc StoreExtendedArc(const std::vector<Line>& lines,
+                       const ConicFitter& fitter);
   void ExtendArcsAndDetectCircle();
   void ExtendArcsAndDetectEllipse();
-  void ValidateCircleAndEllipse(GrayImage& image);
-  bool IsValidCircle(const Circle& circle, GrayImage& image);
-  bool IsValidEllipse(const Ellipse& ellipse, GrayImage& image);
-
-  float getCircleNFA(int circumference_length, int aligned_count);
+  void ValidateCircleAndEllipse(GrayImageView image);
+  bool IsValidCircle(const Circle& circle, GrayImageView image);
+  bool IsValidEllipse(const Ellipse& ellipse, GrayImageView image);
+  int CountAlignedSamples(const std::vector<Position>& positions);
 
  protected:
-  std::list<EdgeSegment> not_closed_edge_segmnets_;
-  std::list<Circle> circles_;
-  std::list<Ellipse> ellipses_;
-  std::list<Arc> arcs_;
-  std::list<Arc> extended_arcs_;
+  std::vector<EdgeSegment> not_closed_edge_segmnets_;
+  std::vector<Circle> circles_;
+  std::vector<Ellipse> ellipses_;
+  std::vector<Arc> arcs_;
+  std::vector<Arc> extended_arcs_;
+
+  // Arcs are views into lines_; merged arcs keep their lines here.
+  std::vector<Line> extended_arc_lines_;
+
+  std::vector<Circle> published_circles_;
+  std::vector<Ellipse> published_ellipses_;
+  std::vector<Arc> published_arcs_;
+  std::vector<Arc> published_extended_arcs_;
+  std::vector<Line> published_extended_arc_lines_;
+
+  struct LineRange {
+    std::size_t begin;
+    std::size_t end;
+  };
+
+  std::vector<LineRange> arc_candidates_;
+  std::vector<float> line_lengths_;
+  std::vector<float> line_angles_;
+  std::vector<unsigned char> turn_directions_;
+  std::vector<Line> extended_lines_;
+  std::vector<Arc> candidate_arcs_;
+  std::vector<Arc> neighbor_arcs_;
+  std::vector<Arc> merged_arcs_;
+  std::vector<Arc> next_extended_arcs_;
+  std::vector<Position> sample_positions_;
+  std::vector<unsigned char> sample_orientations_;
 
   float circle_fitting_error_threshold_;
   float ellipse_fitting_error_threshold_;
   float arc_line_angle_thresholds_[2];
+
+  BinomialNFA circle_nfa_;
 };
 
 #endif
@@ -3,8 +3,10 @@
 #define _USE_MATH_DEFINES
 #include <math.h>
 
+#include <algorithm>
 #include <opencv2/highgui.hpp>
 
+#include "fast_math.h"
 #include "util.h"
 
 EDLine::EDLine() : EDPF() {
@@ -13,15 +15,29 @@ EDLine::EDLine() : EDPF() {
   precision_ = 1.0f / 8.0f;
 }
 
-void EDLine::DetectLine(GrayImage &image) {
-  PrepareEdgeMap(image);
+void EDLine::DetectLine(GrayImageView image) {
+  DetectEdgeSegments(image);
 
   STOPWATCHSTART(verbose_)
   ExtractLine();
   STOPWATCHSTOP(verbose_, "EDLine::DetectLine - ")
+
+  PublishEdgeSegments();
+  PublishLines();
+}
+
+const std::vector<Line> &EDLine::lines() const { return published_lines_; }
+
+void EDLine::Accept(DetectionVisitor &visitor) const {
+  EDPF::Accept(visitor);
+  for (const auto &line : published_lines_) {
+    visitor.VisitLine(line);
+  }
 }
 
-std::list<Line> EDLine::lines() { return lines_; }
+// Lines view the pixels of edge_segments_, so they are published together
+// with the segments.
+void EDLine::PublishLines() { published_lines_.swap(lines_); }
 
 bool EDLine::IsValidLine(const Line &line) {
   float line_angle = line.get_angle();
@@ -32,16 +48,34 @@ bool EDLine::IsValidLine(const Line &line) {
     line_angle += M_PI;
   }
 
-  EdgeSegment edge_segment = line.edge_segment();
+  const EdgeSegment &edge_segment = line.edge_segment();
 
   int aligned_edge_count = 0;
   int segment_length = int(edge_segment.size());
 
+  if (orientation_map_enabled_ == true) {
+    const unsigned char *orientations = orientation_map_.buffer();
+    unsigned char line_orientation =
+        (unsigned char)(int(lround(line_angle / M_PI * kOrientationUnits)) &
+                        (kOrientationUnits - 1));
+    float threshold = aligned_degree_treshold_ / M_PI * kOrientationUnits;
+
+    for (const auto &e : edge_segment) {
+      unsigned char orientation = orientations[get_offset(e.position)];
+      if (OrientationDifference(orientation, line_orientation) < threshold) {
+        aligned_edge_count++;
+      }
+    }
+
+    return line_nfa_.IsMeaningful(segment_length, aligned_edge_count);
+  }
+
   for (const auto &e : edge_segment) {
     std::size_t offset = get_offset(e.position);
 
-    int gx = gx_.buffer()[offset];
-    int gy = gy_.buffer()[offset];
+    int gx = 0;
+    int gy = 0;
+    gradientAt(offset, gx, gy);
 
     if (gy < 0) {
       gy *= -1;
@@ -49,7 +83,7 @@ bool EDLine::IsValidLine(const Line &line) {
       gx *= -1;
     }
 
-    float edge_degree = atan2(float(gx), float(gy));
+    float edge_degree = FastMath::Atan2(float(gx), float(gy));
     float degree_difference = abs(line_angle - edge_degree);
     if (line_angle >= 0.0f && edge_degree < 0.0f) {
       degree_difference = std::min(degree_difference,
@@ -64,99 +98,75 @@ bool EDLine::IsValidLine(const Line &line) {
     }
   }
 
-  float nfa = getLineNFA(segment_length, aligned_edge_count);
-
-  if (nfa <= 1.0f) {
-    return true;
-  } else {
-    return false;
-  }
-}
-
-float EDLine::getLineNFA(int segment_length, int aligned_count) {
-  const float N = float(width_ * height_ * width_ * height_);
-
-  float factorial = 0.0f;
-  for (auto i = aligned_count; i <= segment_length; ++i) {
-    int diff1 = segment_length - i;
-    int diff2 = segment_length - diff1;
-    int bigger_diff = std::max(diff1, diff2);
-    int smaller_diff = std::min(diff1, diff2);
-
-    float _f = 1.0f;
-
-    for (auto n = bigger_diff + 1; n <= segment_length; ++n) {
-      _f *= float(n);
-    }
-    for (auto n = 2; n <= smaller_diff; ++n) {
-      _f /= float(n);
-    }
-
-    _f *= pow(precision_, float(i)) *
-          pow(1.0f - precision_, float(segment_length - i));
-    factorial += _f;
-  }
-
-  return N * factorial;
+  return line_nfa_.IsMeaningful(segment_length, aligned_edge_count);
 }
 
 void EDLine::ExtractLine() {
   minimum_line_length_ = int(
       round(-4.0f * log(sqrt(float(width_) * float(height_))) / log(0.125f)));
 
-  std::list<Line> lines;
+  // N = (width * height)^2 candidate lines.
+  double image_size = double(width_) * double(height_);
+  double diagonal = sqrt(double(width_ * width_ + height_ * height_));
+  line_nfa_.Reset(precision_, 2.0 * log(image_size), int(diagonal));
 
-  for (auto &edge_segment : edge_segments_) {
-    std::vector<Line> line_segments = ExtractLinesFromEdgeSegment(edge_segment);
+  lines_.clear();
 
-    for (auto &line : line_segments) {
-      if (IsValidLine(line) == true) {
-        lines.push_back(line);
-      }
-    }
+  for (const auto &edge_segment : edge_segments_) {
+    ExtractLinesFromEdgeSegment(edge_segment, lines_);
   }
 
-  lines_ = lines;
-}
-
-std::vector<Line> EDLine::ExtractLinesFromEdgeSegment(const EdgeSegment &edge_segment) {
-  std::list<Line> lines;
+  std::size_t valid_count = 0;
 
-  EdgeSegment::const_iterator line_candidate_begin = edge_segment.begin();
-  EdgeSegment::const_iterator line_candidate_end = edge_segment.begin();
-
-  for (auto i = 0;
-       i < minimum_line_length_ && line_candidate_end != edge_segment.end();
-       ++i) {
-    line_candidate_end++;
+  for (std::size_t i = 0; i < lines_.size(); i++) {
+    if (IsValidLine(lines_[i]) == true) {
+      lines_[valid_count++] = lines_[i];
+    }
   }
 
-  EdgeSegment _segment;
-  _segment.insert(_segment.end(), line_candidate_begin, line_candidate_end);
+  lines_.erase(lines_.begin() + valid_count, lines_.end());
+}
+
+// Appends the lines found along edge_segment to lines.
+void EDLine::ExtractLinesFromEdgeSegment(const EdgeSegment &edge_segment,
+                                         std::vector<Line> &lines) {
+  // The line candidate is the window [line_candidate_begin,
+  // line_candidate_end) of the segment.
+  const Edgel *line_candidate_begin = edge_segment.begin();
+  const Edgel *line_candidate_end =
+      edge_segment.begin() +
+      std::min(edge_segment.size(), std::size_t(minimum_line_length_));
 
   while (true) {
-    if (_segment.size() < minimum_line_length_) {
+    if (line_candidate_end - line_candidate_begin < minimum_line_length_) {
       break;
     }
 
-    Line new_line = Line::FitFromEdgeSegment(_segment);
+    line_fitter_.Reset();
+    line_fitter_.Add(line_candidate_begin, line_candidate_end);
+
+    float fitting_error = line_fitter_.fitting_error();
 
-    while (new_line.fitting_error() > 1.0f) {
+    while (fitting_error > 1.0f) {
       if (line_candidate_end == edge_segment.end()) {
         break;
       }
 
-      _segment.pop_front();
-      _segment.push_back(*line_candidate_end);
+      line_fitter_.Remove(line_candidate_begin->position);
+      line_fitter_.Add(line_candidate_end->position);
+      line_candidate_begin++;
       line_candidate_end++;
 
-      new_line = Line::FitFromEdgeSegment(_segment);
+      fitting_error = line_fitter_.fitting_error();
     }
 
-    if (new_line.fitting_error() > 1.0f) {
+    if (fitting_error > 1.0f) {
       break;
     }
 
+    Line new_line = line_fitter_.Fit(
+        EdgeSegment(line_candidate_begin, line_candidate_end));
+
     while (line_candidate_end != edge_segment.end()) {
       float error = new_line.ComputeError(line_candidate_end->position);
 
@@ -164,31 +174,18 @@ std::vector<Line> EDLine::ExtractLinesFromEdgeSegment(const EdgeSegment &edge_se
         break;
       }
 
-      _segment.push_back(*line_candidate_end);
+      line_fitter_.Add(line_candidate_end->position);
       line_candidate_end++;
     }
 
-    new_line = Line::FitFromEdgeSegment(_segment);
+    new_line = line_fitter_.Fit(
+        EdgeSegment(line_candidate_begin, line_candidate_end));
 
     lines.push_back(new_line);
 
     line_candidate_begin = line_candidate_end;
-
-    while (line_candidate_begin != line_candidate_end) {
-      line_candidate_begin++;
-    }
-
-    for (auto i = 0;
-         i < minimum_line_length_ && line_candidate_end != edge_segment.end();
-         ++i) {
-      line_candidate_end++;
-    }
-    _segment.clear();
-    _segment.insert(_segment.end(), line_candidate_begin, line_candidate_end);
+    line_candidate_end += std::min(
+        std::size_t(edge_segment.end() - line_candidate_end),
+        std::size_t(minimum_line_length_));
   }
-
-  std::vector<Line> line_vector;
-  line_vector.insert(line_vector.end(), lines.begin(), lines.end());
-
-  return line_vector;
 }
@@ -3,26 +3,33 @@
 
 #include "edpf.h"
 #include "image/image.h"
+#include "nfa.h"
 #include "primitives/line.h"
+#include "primitives/line_fitter.h"
 
 class EDLine : public EDPF {
  public:
   EDLine();
 
  public:
-  void DetectLine(GrayImage &image);
+  void DetectLine(GrayImageView image);
 
-  std::list<Line> lines();
+  const std::vector<Line> &lines() const;
+  void Accept(DetectionVisitor &visitor) const override;
 
  protected:
+  void PublishLines();
   void ExtractLine();
-  std::vector<Line> ExtractLinesFromEdgeSegment(const EdgeSegment &segment);
+  void ExtractLinesFromEdgeSegment(const EdgeSegment &segment,
+                                   std::vector<Line> &lines);
 
   bool IsValidLine(const Line &line);
-  float getLineNFA(int segment_length, int aligned_count);
 
  protected:
-  std::list<Line> lines_;
+  std::vector<Line> lines_;
+  std::vector<Line> published_lines_;
+  LineFitter line_fitter_;
+  BinomialNFA line_nfa_;
 
  protected:
   int minimum_line_length_ = 0.0f;
@@ -1,29 +1,213 @@
 #include "edge_drawing.h"
 
+#define _USE_MATH_DEFINES
+#include <math.h>
+
+#include <cstring>
+
 #include "image/filter.h"
 #include "util.h"
 
+#if defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define EDGE_DRAWING_USE_SSE2
+#include <emmintrin.h>
+#endif
+
+namespace {
+
+struct NeighborStep {
+  int dx;
+  int dy;
+};
+
+// The three pixels a walk may step to for each ConnectingAim, in the order
+// Left, Up, Right, Down.
+const NeighborStep kNeighborSteps[4][3] = {
+    {{-1, -1}, {-1, 0}, {-1, 1}},
+    {{-1, -1}, {0, -1}, {1, -1}},
+    {{1, -1}, {1, 0}, {1, 1}},
+    {{-1, 1}, {0, 1}, {1, 1}}};
+
+// The aim after a step, by current aim, neighbour taken and the edge direction
+// at the new pixel. A vertical edge continues up, or down if the step went
+// down; a horizontal edge continues left, or right if the step went right.
+// When the direction does not change this gives back the current aim.
+const int kNextAims[4][3][2] = {
+    {{1, 0}, {1, 0}, {3, 0}},
+    {{1, 0}, {1, 0}, {1, 2}},
+    {{1, 2}, {1, 2}, {3, 2}},
+    {{3, 0}, {3, 0}, {3, 2}}};
+
+// atan(i / kOrientationRatioSteps) in units of pi / 256 (see
+// EdgeDrawing::kOrientationUnits), for i up to kOrientationRatioSteps. The
+// ratio step adds at most 0.04 units of error.
+const int kOrientationRatioSteps = 1024;
+
+const std::vector<unsigned char>& OrientationRatioTable() {
+  static const std::vector<unsigned char> table = [] {
+    std::vector<unsigned char> values(kOrientationRatioSteps + 1);
+    for (auto i = 0; i <= kOrientationRatioSteps; ++i) {
+      double angle = atan(double(i) / kOrientationRatioSteps);
+      values[i] = (unsigned char)(int(angle / M_PI * 256.0 + 0.5));
+    }
+    return values;
+  }();
+
+  return table;
+}
+
+#ifdef EDGE_DRAWING_USE_SSE2
+inline __m128 LoadMagnitudes(const GradientPlanes& planes,
+                             std::size_t offset) {
+  return _mm_loadu_ps(planes.magnitude + offset);
+}
+
+inline __m128 LoadMagnitudes(const CompactGradientPlanes& planes,
+                             std::size_t offset) {
+  __m128i words = _mm_loadl_epi64((const __m128i*)(planes.magnitude + offset));
+  words = _mm_and_si128(
+      words, _mm_set1_epi16(short(CompactGradientPlanes::kMagnitudeMask)));
+  __m128i values = _mm_unpacklo_epi16(words, _mm_setzero_si128());
+
+  return _mm_mul_ps(
+      _mm_cvtepi32_ps(values),
+      _mm_set1_ps(1.0f / float(CompactGradientPlanes::kMagnitudeScale)));
+}
+
+// All bits set in the lanes whose edge direction is horizontal.
+inline __m128 LoadHorizontalMask(const GradientPlanes& planes,
+                                 std::size_t offset) {
+  int bytes = 0;
+  memcpy(&bytes, planes.direction + offset, sizeof(bytes));
+  bytes &= 0x01010101 * GradientPlanes::kDirectionMask;
+
+  const __m128i zero = _mm_setzero_si128();
+  __m128i directions = _mm_cvtsi32_si128(bytes);
+  directions = _mm_unpacklo_epi8(directions, zero);
+  directions = _mm_unpacklo_epi16(directions, zero);
+
+  return _mm_castsi128_ps(_mm_cmpeq_epi32(
+      directions, _mm_set1_epi32(int(EdgeDirection::HorizontalEdge))));
+}
+
+inline __m128 LoadHorizontalMask(const CompactGradientPlanes& planes,
+                                 std::size_t offset) {
+  const __m128i direction_bit =
+      _mm_set1_epi32(CompactGradientPlanes::kDirectionBit);
+  __m128i words = _mm_loadl_epi64((const __m128i*)(planes.magnitude + offset));
+  __m128i values = _mm_unpacklo_epi16(words, _mm_setzero_si128());
+
+  return _mm_castsi128_ps(
+      _mm_cmpeq_epi32(_mm_and_si128(values, direction_bit), direction_bit));
+}
+
+inline __m128 Select(__m128 mask, __m128 a, __m128 b) {
+  return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+}
+
+// The set lanes of each four-lane mask in order, padded with the last one so
+// that all four slots can be stored unconditionally, and how many are set.
+const unsigned char kMaskLanes[16][4] = {
+    {0, 0, 0, 0}, {0, 0, 0, 0}, {1, 1, 1, 1}, {0, 1, 1, 1},
+    {2, 2, 2, 2}, {0, 2, 2, 2}, {1, 2, 2, 2}, {0, 1, 2, 2},
+    {3, 3, 3, 3}, {0, 3, 3, 3}, {1, 3, 3, 3}, {0, 1, 3, 3},
+    {2, 3, 3, 3}, {0, 2, 3, 3}, {1, 2, 3, 3}, {0, 1, 2, 3}};
+const int kMaskLaneCounts[16] = {0, 1, 1, 2, 1, 2, 2, 3,
+                                 1, 2, 2, 3, 2, 3, 3, 4};
+#endif
+
+}  // namespace
+
 EdgeDrawing::EdgeDrawing(float magnitude_threshold, float anchor_threshold,
                          int anchor_extraction_interval)
     : magnitude_threshold_(magnitude_threshold),
       anchor_threshold_(anchor_threshold),
       anchor_extraction_interval_(anchor_extraction_interval),
+      smoothed_image_(0, 0),
       gx_(0, 0),
       gy_(0, 0),
       magnitude_(0, 0),
       direction_map_(0, 0),
+      orientation_map_(0, 0),
+      compact_gx_(0, 0),
+      compact_gy_(0, 0),
+      compact_magnitude_(0, 0),
       edge_map_(0, 0),
-      verbose_(false) {}
+      tile_edge_map_(0, 0),
+      verbose_(false) {
+  smoothed_image_.Reset(0, 0, kGuardBorder);
+  gx_.Reset(0, 0, kGuardBorder);
+  gy_.Reset(0, 0, kGuardBorder);
+  magnitude_.Reset(0, 0, kGuardBorder);
+  direction_map_.Reset(0, 0, kGuardBorder);
+  orientation_map_.Reset(0, 0, kGuardBorder);
+  compact_gx_.Reset(0, 0, kGuardBorder);
+  compact_gy_.Reset(0, 0, kGuardBorder);
+  compact_magnitude_.Reset(0, 0, kGuardBorder);
+  edge_map_.Reset(0, 0, kGuardBorder);
+  tile_edge_map_.Reset(0, 0, kGuardBorder);
+}
 
 void EdgeDrawing::set_verbose(bool verbose) { verbose_ = verbose; }
 
-void EdgeDrawing::DetectEdge(GrayImage& image) {
+void EdgeDrawing::set_gaussian_smoothing(std::size_t size, float sigma) {
+  gaussian_size_ = size;
+  gaussian_sigma_ = sigma;
+
+  if (size > 0) {
+    Filter::CreateGaussianKernel(size, sigma, gaussian_kernel_);
+  }
+}
+
+void EdgeDrawing::set_compact_gradient(bool compact) {
+  // The edge flags of the other layout are not tracked after a switch, so its
+  // map is reallocated on first use.
+  if (compact != compact_gradient_) {
+    edge_map_.Reset(0, 0);
+    edge_pixels_.clear();
+  }
+
+  compact_gradient_ = compact;
+}
+
+void EdgeDrawing::set_thread_count(std::size_t thread_count) {
+  thread_count_ = std::max(thread_count, std::size_t(1));
+  link_workers_.set_worker_count(thread_count_ - 1);
+}
+
+void EdgeDrawing::set_edge_segment_callback(EdgeSegmentCallback callback) {
+  edge_segment_callback_ = callback;
+}
+
+void EdgeDrawing::set_orientation_map(bool enabled) {
+  orientation_map_enabled_ = enabled;
+  if (enabled == false) {
+    orientation_map_.Resize(0, 0);
+  }
+}
+
+void EdgeDrawing::DetectEdge(GrayImageView image) {
+  DetectEdgeSegments(image);
+  PublishEdgeSegments();
+}
+
+const EdgeSegmentStore& EdgeDrawing::edge_segments() const {
+  return published_edge_segments_;
+}
+
+void EdgeDrawing::Accept(DetectionVisitor& visitor) const {
+  for (const auto& edge_segment : published_edge_segments_) {
+    visitor.VisitEdgeSegment(edge_segment);
+  }
+}
+
+GrayImage& EdgeDrawing::smoothed_image() { return smoothed_image_; }
+
+void EdgeDrawing::DetectEdgeSegments(GrayImageView image) {
   width_ = image.width();
   height_ = image.height();
 
-  std::chrono::system_clock::time_point start;
-  std::chrono::duration<double> elapsed_time;
-
   STOPWATCHSTART(verbose_)
   PrepareEdgeMap(image);
   STOPWATCHSTOP(verbose_, "EdgeDrawing::PrepareEdgeMap - ")
@@ -37,15 +221,26 @@ void EdgeDrawing::DetectEdge(GrayImage& image) {
   STOPWATCHSTOP(verbose_, "EdgeDrawing::ConnectingAnchors - ")
 }
 
-std::list<EdgeSegment> EdgeDrawing::edge_segments() { return edge_segments_; }
+// The stores trade buffers, so the pixels keep their addresses and the views
+// into them stay valid.
+void EdgeDrawing::PublishEdgeSegments() {
+  published_edge_segments_.swap(edge_segments_);
+}
+
+void EdgeDrawing::PrepareEdgeMap(GrayImageView image) {
+  if (gaussian_size_ > 0 || compact_gradient_ == true) {
+    PrepareStreamedEdgeMap(image);
+    PrepareOrientationMap();
+    return;
+  }
 
-void EdgeDrawing::PrepareEdgeMap(GrayImage& image) {
   Filter::Sobel(image, gx_, gy_, magnitude_);
 
   int image_width = image.width();
   int image_height = image.height();
 
-  direction_map_.Reset(image_width, image_height);
+  direction_map_.Resize(image_width, image_height);
+  stride_ = magnitude_.stride();
 
   for (auto y = 1; y < image_height; ++y) {
     std::size_t offset = get_offset(Position(0, y));
@@ -63,30 +258,188 @@ void EdgeDrawing::PrepareEdgeMap(GrayImage& image) {
       }
     }
   }
+
+  PrepareOrientationMap();
+}
+
+// Quantizes the level-line orientation of every pixel from the gradient
+// planes, so the line and circle validation only compares bytes.
+void EdgeDrawing::PrepareOrientationMap() {
+  if (orientation_map_enabled_ == false) {
+    return;
+  }
+
+  orientation_map_.Resize(width_, height_);
+
+  for (std::size_t y = 0; y < height_; ++y) {
+    std::size_t offset = get_offset(Position(0, int(y)));
+    unsigned char* orientation_ptr = orientation_map_.buffer() + offset;
+
+    for (std::size_t x = 0; x < width_; ++x) {
+      int gx = 0;
+      int gy = 0;
+      gradientAt(offset + x, gx, gy);
+
+      orientation_ptr[x] = QuantizeOrientation(float(gy), float(-gx));
+    }
+  }
+}
+
+void EdgeDrawing::PrepareStreamedEdgeMap(GrayImageView image) {
+  int image_width = image.width();
+  int image_height = image.height();
+
+  if (compact_gradient_ == true) {
+    gx_.Resize(0, 0);
+    gy_.Resize(0, 0);
+    magnitude_.Resize(0, 0);
+    direction_map_.Resize(0, 0);
+    compact_gx_.Resize(image_width, image_height);
+    compact_gy_.Resize(image_width, image_height);
+    compact_magnitude_.Resize(image_width, image_height);
+    row_gx_.resize(image_width);
+    row_gy_.resize(image_width);
+    row_magnitude_.resize(image_width);
+  } else {
+    gx_.Resize(image_width, image_height);
+    gy_.Resize(image_width, image_height);
+    magnitude_.Resize(image_width, image_height);
+    direction_map_.Resize(image_width, image_height);
+    compact_gx_.Resize(0, 0);
+    compact_gy_.Resize(0, 0);
+    compact_magnitude_.Resize(0, 0);
+  }
+
+  stride_ = compact_gradient_ == true ? compact_magnitude_.stride()
+                                      : magnitude_.stride();
+
+  if (gaussian_size_ == 0) {
+    for (auto y = 1; y < image_height - 1; ++y) {
+      PrepareGradientRow(image.row(y - 1), image.row(y), image.row(y + 1),
+                         image_width, y);
+    }
+    return;
+  }
+
+  smoothed_image_.Resize(image_width, image_height);
+
+  int filter_size = int(gaussian_size_);
+  int filter_center = int(roundf(float(filter_size - 1) / 2.0f));
+
+  gaussian_column_sums_.resize(image_width + filter_size);
+  gaussian_rows_.resize(filter_size);
+
+  // Smoothing row y completes the 3x3 neighbourhood of row y - 1, so the
+  // gradient and direction of that row are computed while all three
+  // smoothed rows are still hot in cache.
+  for (auto y = 0; y < image_height; ++y) {
+    for (auto fy = 0; fy < filter_size; ++fy) {
+      int image_y =
+          std::min(std::max(y - filter_center + fy, 0), image_height - 1);
+      gaussian_rows_[fy] = image.row(image_y);
+    }
+
+    Filter::GaussianRow(gaussian_rows_.data(), gaussian_kernel_.data(),
+                        filter_size, gaussian_column_sums_.data(),
+                        smoothed_image_.row(y), image_width);
+
+    if (y - 1 >= 1) {
+      PrepareGradientRow(smoothed_image_.row(y - 2),
+                         smoothed_image_.row(y - 1), smoothed_image_.row(y),
+                         image_width, y - 1);
+    }
+  }
+}
+
+void EdgeDrawing::PrepareGradientRow(const unsigned char* above,
+                                     const unsigned char* current,
+                                     const unsigned char* below, int width,
+                                     int y) {
+  std::size_t offset = get_offset(Position(0, y));
+
+  if (compact_gradient_ == false) {
+    Filter::SobelRow(above, current, below, gx_.buffer() + offset,
+                     gy_.buffer() + offset, magnitude_.buffer() + offset,
+                     width);
+
+    auto x_ptr = gx_.buffer() + offset;
+    auto y_ptr = gy_.buffer() + offset;
+    auto direction_ptr = direction_map_.buffer() + offset;
+
+    for (auto x = 1; x < width - 1; ++x) {
+      if (abs(x_ptr[x]) >= abs(y_ptr[x])) {
+        direction_ptr[x] = (unsigned char)EdgeDirection::VerticalEdge;
+      } else {
+        direction_ptr[x] = (unsigned char)EdgeDirection::HorizontalEdge;
+      }
+    }
+    return;
+  }
+
+  // The gradient row is computed at full precision into scratch rows that
+  // stay in L1 and then narrowed; Sobel on 8-bit input fits in 16 bits.
+  Filter::SobelRow(above, current, below, row_gx_.data(), row_gy_.data(),
+                   row_magnitude_.data(), width);
+
+  auto x_ptr = compact_gx_.buffer() + offset;
+  auto y_ptr = compact_gy_.buffer() + offset;
+  auto magnitude_ptr = compact_magnitude_.buffer() + offset;
+
+  const float scale = float(CompactGradientPlanes::kMagnitudeScale);
+
+  for (auto x = 1; x < width - 1; ++x) {
+    int gx = row_gx_[x];
+    int gy = row_gy_[x];
+
+    int magnitude = std::min(int(row_magnitude_[x] * scale + 0.5f),
+                             int(CompactGradientPlanes::kMagnitudeMask));
+
+    if (abs(gx) < abs(gy)) {
+      magnitude |= CompactGradientPlanes::kDirectionBit;
+    }
+
+    x_ptr[x] = (short)gx;
+    y_ptr[x] = (short)gy;
+    magnitude_ptr[x] = (unsigned short)magnitude;
+  }
 }
 
 void EdgeDrawing::ExtractAnchor() {
+  if (compact_gradient_ == true) {
+    ExtractAnchor(compact_gradient_planes());
+  } else {
+    ExtractAnchor(gradient_planes());
+  }
+}
+
+template <typename Planes>
+void EdgeDrawing::ExtractAnchor(const Planes& planes) {
   anchors_.clear();
 
   int x_start = std::max(1, anchor_extraction_interval_ / 2);
   int y_start = std::max(1, anchor_extraction_interval_ / 2);
 
   for (auto y = y_start; y < height_ - 1; y += anchor_extraction_interval_) {
-    auto direction_map_ptr = direction_map_.buffer() + (y * width_);
-    auto magnitude_ptr = magnitude_.buffer() + (y * width_);
+    std::size_t y_offset = y * stride_;
+
+    int x = x_start;
+    if (anchor_extraction_interval_ == 1) {
+      x = ExtractAnchorBlock(planes, y);
+    }
+
+    for (; x < width_ - 1; x += anchor_extraction_interval_) {
+      std::size_t offset = y_offset + x;
 
-    for (auto x = x_start; x < width_ - 1; x += anchor_extraction_interval_) {
-      float magnitude = magnitude_ptr[x];
+      float magnitude = planes.magnitudeAt(offset);
       float neighbor0 = 0.0f;
       float neighbor1 = 0.0f;
 
-      if (direction_map_ptr[x] ==
-          (unsigned char)EdgeDirection::HorizontalEdge) {
-        neighbor0 = magnitude_ptr[x - width_];
-        neighbor1 = magnitude_ptr[x + width_];
+      if (planes.directionAt(offset) == EdgeDirection::HorizontalEdge) {
+        neighbor0 = planes.magnitudeAt(offset - stride_);
+        neighbor1 = planes.magnitudeAt(offset + stride_);
       } else {
-        neighbor0 = magnitude_ptr[x - 1];
-        neighbor1 = magnitude_ptr[x + 1];
+        neighbor0 = planes.magnitudeAt(offset - 1);
+        neighbor1 = planes.magnitudeAt(offset + 1);
       }
 
       if (magnitude - neighbor0 >= anchor_threshold_ &&
@@ -98,182 +451,423 @@ void EdgeDrawing::ExtractAnchor() {
   }
 }
 
+// Tests four pixels at a time. The anchors of each block are compacted from
+// the comparison mask into row_anchors_, which is appended to anchors_ once
+// per row. Returns the first column left for the scalar loop.
+template <typename Planes>
+int EdgeDrawing::ExtractAnchorBlock(const Planes& planes, int y) {
+  int x = 1;
+
+#ifdef EDGE_DRAWING_USE_SSE2
+  const __m128 threshold = _mm_set1_ps(anchor_threshold_);
+  int x_end = int(width_) - 1;
+  std::size_t y_offset = y * stride_;
+
+  std::vector<Edgel>& row_anchors = row_anchors_;
+  if (row_anchors.size() < width_ + 4) {
+    row_anchors.resize(width_ + 4, Edgel{Position(0, 0), 0.0f});
+  }
+  std::size_t count = 0;
+
+  for (; x + 4 <= x_end; x += 4) {
+    std::size_t offset = y_offset + x;
+
+    __m128 magnitude = LoadMagnitudes(planes, offset);
+    __m128 horizontal = LoadHorizontalMask(planes, offset);
+    __m128 neighbor0 = Select(horizontal,
+                              LoadMagnitudes(planes, offset - stride_),
+                              LoadMagnitudes(planes, offset - 1));
+    __m128 neighbor1 = Select(horizontal,
+                              LoadMagnitudes(planes, offset + stride_),
+                              LoadMagnitudes(planes, offset + 1));
+
+    __m128 is_anchor = _mm_and_ps(
+        _mm_cmpge_ps(_mm_sub_ps(magnitude, neighbor0), threshold),
+        _mm_cmpge_ps(_mm_sub_ps(magnitude, neighbor1), threshold));
+
+    int mask = _mm_movemask_ps(is_anchor);
+    if (mask == 0) {
+      continue;
+    }
+
+    float magnitudes[4];
+    _mm_storeu_ps(magnitudes, magnitude);
+
+    const unsigned char* lanes = kMaskLanes[mask];
+    for (auto slot = 0; slot < 4; ++slot) {
+      row_anchors[count + slot] =
+          Edgel{Position(x + lanes[slot], y), magnitudes[lanes[slot]]};
+    }
+    count += kMaskLaneCounts[mask];
+  }
+
+  anchors_.insert(anchors_.end(), row_anchors.begin(),
+                  row_anchors.begin() + count);
+#endif
+
+  return x;
+}
+
 void EdgeDrawing::ConnectAnchor() {
-  edge_map_.Reset(width_, height_);
+  if (compact_gradient_ == true) {
+    ConnectAnchor(compact_gradient_planes());
+  } else {
+    ConnectAnchor(gradient_planes());
+  }
+}
 
-  auto direction_map_ptr = direction_map_.buffer();
+template <typename Planes>
+void EdgeDrawing::ConnectAnchor(const Planes& planes) {
+  ClearEdgeMap();
 
   edge_segments_.clear();
 
-  for (auto& anchor : anchors_) {
-    EdgeSegment edge_segment;
+  for (auto aim = 0; aim < 4; ++aim) {
+    for (auto i = 0; i < 3; ++i) {
+      const NeighborStep& step = kNeighborSteps[aim][i];
+      neighbor_offsets_[aim][i] =
+          std::ptrdiff_t(step.dy) * std::ptrdiff_t(stride_) + step.dx;
+    }
+  }
 
+  if (thread_count_ > 1 && height_ >= kMinimumLinkTileRows * thread_count_) {
+    ConnectAnchorInTiles(planes);
+    return;
+  }
+
+  for (auto& anchor : anchors_) {
     if (is_edge(anchor.position) == true) {
       continue;
     }
 
-    set_edge(anchor.position, true);
-    edge_segment.push_back(anchor);
-    bool push_back = true;
+    LinkAnchor(planes, anchor, edge_map(), 0, int(height_), anchor_walks_);
+    AddSegment(anchor, anchor_walks_);
+  }
+}
+
+// Links the anchors tile by tile on several threads, then replays them in
+// anchor order against the shared edge map. A tile result is only taken if
+// the pixels it claims are still free and every pixel it stopped at is set,
+// which is exactly the condition for the sequential walk to take the same
+// path. Anchors failing the check, or whose walks left their tile, are
+// linked again sequentially, so the output never depends on the tiling or
+// on the thread count.
+template <typename Planes>
+void EdgeDrawing::ConnectAnchorInTiles(const Planes& planes) {
+  std::size_t tile_count = thread_count_ * kLinkTilesPerThread;
+  std::size_t tile_rows = (height_ + tile_count - 1) / tile_count;
+  if (tile_rows < kMinimumLinkTileRows) {
+    tile_rows = kMinimumLinkTileRows;
+  }
+  tile_count = (height_ + tile_rows - 1) / tile_rows;
+
+  link_tiles_.resize(tile_count);
+  for (std::size_t t = 0; t < tile_count; ++t) {
+    link_tiles_[t].row_begin = int(t * tile_rows);
+    link_tiles_[t].row_end = int(std::min(height_, (t + 1) * tile_rows));
+    link_tiles_[t].anchors.clear();
+  }
+
+  for (std::size_t i = 0; i < anchors_.size(); ++i) {
+    link_tiles_[anchors_[i].position.y / tile_rows].anchors.push_back(i);
+  }
+
+  tile_edge_map_.Resize(width_, height_);
 
-    EdgeDirection direction = directionAt(anchor.position);
+  auto link_tile = [&](std::size_t t) { LinkTile(planes, link_tiles_[t]); };
+  link_workers_.Run(tile_count, link_tile);
 
-    ConnectingAim aims[2];
+  unsigned char* linked_map = edge_map();
+  std::vector<std::size_t>& cursors = link_tile_cursors_;
+  cursors.assign(tile_count, 0);
 
-    if (direction == EdgeDirection::HorizontalEdge) {
-      aims[0] = ConnectingAim::Left;
-      aims[1] = ConnectingAim::Right;
-    } else {
-      aims[0] = ConnectingAim::Up;
-      aims[1] = ConnectingAim::Down;
+  for (const auto& anchor : anchors_) {
+    std::size_t t = anchor.position.y / tile_rows;
+    LinkTileState& tile = link_tiles_[t];
+    const AnchorLink& link = tile.links[cursors[t]++];
+    std::size_t anchor_offset = get_offset(anchor.position);
+
+    if (link.skipped == true && (linked_map[anchor_offset] & kEdgeBit) != 0) {
+      continue;
     }
 
-    for (const auto aim : aims) {
-      if (aim == aims[0]) {
-        push_back = true;
-      } else {
-        push_back = false;
+    if (link.skipped == false && link.complete == true &&
+        CommitAnchorLink(tile, link) == true) {
+      continue;
+    }
+
+    if ((linked_map[anchor_offset] & kEdgeBit) != 0) {
+      continue;
+    }
+
+    LinkAnchor(planes, anchor, linked_map, 0, int(height_), anchor_walks_);
+    AddSegment(anchor, anchor_walks_);
+  }
+
+  unsigned char* tile_edge_map = tile_edge_map_.buffer();
+  for (const auto& tile : link_tiles_) {
+    for (const auto& pixel : tile.pixels) {
+      tile_edge_map[get_offset(pixel.position)] = 0;
+    }
+  }
+}
+
+template <typename Planes>
+void EdgeDrawing::LinkTile(const Planes& planes, LinkTileState& tile) {
+  unsigned char* edge_map = tile_edge_map_.buffer();
+
+  tile.links.clear();
+  tile.pixels.clear();
+
+  for (auto i : tile.anchors) {
+    const Edgel& anchor = anchors_[i];
+
+    AnchorLink link;
+    link.skipped = (edge_map[get_offset(anchor.position)] & kEdgeBit) != 0;
+    link.complete = true;
+    link.begin = tile.pixels.size();
+    link.stop_count = 0;
+
+    if (link.skipped == false) {
+      AnchorWalks& walks = tile.walks;
+      link.complete = LinkAnchor(planes, anchor, edge_map, tile.row_begin,
+                                 tile.row_end, walks);
+
+      tile.pixels.insert(tile.pixels.end(), walks.backward.rbegin(),
+                         walks.backward.rend());
+      tile.pixels.push_back(anchor);
+      tile.pixels.insert(tile.pixels.end(), walks.forward.begin(),
+                         walks.forward.end());
+
+      link.stop_count = walks.stop_count;
+      for (auto s = 0; s < walks.stop_count; ++s) {
+        link.stop_offsets[s] = walks.stop_offsets[s];
       }
+    }
+
+    link.end = tile.pixels.size();
+    tile.links.push_back(link);
+  }
+}
+
+bool EdgeDrawing::CommitAnchorLink(const LinkTileState& tile,
+                                   const AnchorLink& link) {
+  unsigned char* linked_map = edge_map();
+  const Edgel* first = tile.pixels.data() + link.begin;
+  const Edgel* last = tile.pixels.data() + link.end;
+
+  for (auto pixel = first; pixel != last; ++pixel) {
+    if ((linked_map[get_offset(pixel->position)] & kEdgeBit) != 0) {
+      return false;
+    }
+  }
+
+  for (auto pixel = first; pixel != last; ++pixel) {
+    linked_map[get_offset(pixel->position)] |= kEdgeBit;
+  }
 
-      Position current_position = anchor.position;
-      ConnectingAim currenct_aim = aim;
-      EdgeDirection current_direction = direction;
-
-      Position next_position =
-          FindNextConnectingPosition(current_position, currenct_aim);
-
-      while (true) {
-        if (isValidPosition(next_position) == false) {
-          break;
-        }
-
-        float next_magnitude = magnitudeAt(next_position);
-        bool edge = is_edge(next_position);
-
-        if (next_magnitude == 0.0f || edge == true) {
-          break;
-        }
-
-        set_edge(next_position, true);
-
-        Edgel next_edge{next_position, next_magnitude};
-        if (push_back == true) {
-          edge_segment.push_back(next_edge);
-        } else {
-          edge_segment.push_front(next_edge);
-        }
-
-        EdgeDirection next_direction = directionAt(next_position);
-
-        if (current_direction != next_direction) {
-          if (next_direction == EdgeDirection::VerticalEdge) {
-            if (next_position.y > current_position.y) {
-              currenct_aim = ConnectingAim::Down;
-            } else {
-              currenct_aim = ConnectingAim::Up;
-            }
-          } else if (next_direction == EdgeDirection::HorizontalEdge) {
-            if (next_position.x > current_position.x) {
-              currenct_aim = ConnectingAim::Right;
-            } else {
-              currenct_aim = ConnectingAim::Left;
-            }
-          } else {
-            throw std::runtime_error("Something wrong..");
-          }
-        }
-
-        current_position = next_position;
-        current_direction = next_direction;
-        next_position =
-            FindNextConnectingPosition(current_position, currenct_aim);
+  // A walk that ended on an edge pixel must find it set here as well, either
+  // by an earlier anchor or by its own chain.
+  for (auto s = 0; s < link.stop_count; ++s) {
+    if ((linked_map[link.stop_offsets[s]] & kEdgeBit) == 0) {
+      for (auto pixel = first; pixel != last; ++pixel) {
+        linked_map[get_offset(pixel->position)] &= ~kEdgeBit;
       }
+      return false;
     }
+  }
+
+  for (auto pixel = first; pixel != last; ++pixel) {
+    edge_pixels_.push_back(get_offset(pixel->position));
+  }
 
-    edge_segments_.push_back(edge_segment);
-  }
-}
-
-Position EdgeDrawing::FindNextConnectingPosition(Position position,
-                                                 ConnectingAim direction) {
-  float neighbor_magnitudes[3] = {0.0f, 0.0f, 0.0f};
-  Position neighbor_positions[3] = {position, position, position};
-
-  switch (direction) {
-    case ConnectingAim::Left:
-      neighbor_positions[0].x -= 1;
-      neighbor_positions[0].y -= 1;
-      neighbor_positions[1].x -= 1;
-      neighbor_positions[2].x -= 1;
-      neighbor_positions[2].y += 1;
-      break;
-    case ConnectingAim::Right:
-      neighbor_positions[0].x += 1;
-      neighbor_positions[0].y -= 1;
-      neighbor_positions[1].x += 1;
-      neighbor_positions[2].x += 1;
-      neighbor_positions[2].y += 1;
-      break;
-    case ConnectingAim::Up:
-      neighbor_positions[0].x -= 1;
-      neighbor_positions[0].y -= 1;
-      neighbor_positions[1].y -= 1;
-      neighbor_positions[2].x += 1;
-      neighbor_positions[2].y -= 1;
-      break;
-    case ConnectingAim::Down:
-      neighbor_positions[0].x -= 1;
-      neighbor_positions[0].y += 1;
-      neighbor_positions[1].y += 1;
-      neighbor_positions[2].x += 1;
-      neighbor_positions[2].y += 1;
-      break;
-  }
-
-  for (int i = 0; i < 3; ++i) {
-    if (isValidPosition(neighbor_positions[i]) == true) {
-      neighbor_magnitudes[i] = magnitudeAt(neighbor_positions[i]);
+  edge_segments_.AddPixels(first, last);
+  edge_segments_.CloseSegment();
+  if (stream_linked_segments_ == true) {
+    StreamSegment(edge_segments_);
+  }
+  return true;
+}
+
+// Links one anchor against edge_map: the first walk extends the chain
+// forward, the second backward. Returns false if a walk had to stop at a row
+// outside [row_begin, row_end).
+template <typename Planes>
+bool EdgeDrawing::LinkAnchor(const Planes& planes, const Edgel& anchor,
+                             unsigned char* edge_map, int row_begin,
+                             int row_end, AnchorWalks& walks) {
+  std::size_t anchor_offset = get_offset(anchor.position);
+  edge_map[anchor_offset] |= kEdgeBit;
+
+  EdgeDirection direction = planes.directionAt(anchor_offset);
+
+  ConnectingAim aims[2];
+
+  if (direction == EdgeDirection::HorizontalEdge) {
+    aims[0] = ConnectingAim::Left;
+    aims[1] = ConnectingAim::Right;
+  } else {
+    aims[0] = ConnectingAim::Up;
+    aims[1] = ConnectingAim::Down;
+  }
+
+  std::vector<Edgel>* walk_pixels[2] = {&walks.forward, &walks.backward};
+  walks.stop_count = 0;
+  bool complete = true;
+
+  for (auto i = 0; i < 2; ++i) {
+    std::vector<Edgel>& walk = *walk_pixels[i];
+    walk.clear();
+
+    std::size_t offset = anchor_offset;
+    int x = anchor.position.x;
+    int y = anchor.position.y;
+    int aim = int(aims[i]);
+
+    // Every plane has a zero guard border, so a step off the image reads a
+    // zero magnitude and ends the walk without a bounds check.
+    while (true) {
+      const std::ptrdiff_t* neighbor_offsets = neighbor_offsets_[aim];
+      float magnitudes[3] = {planes.magnitudeAt(offset + neighbor_offsets[0]),
+                             planes.magnitudeAt(offset + neighbor_offsets[1]),
+                             planes.magnitudeAt(offset + neighbor_offsets[2])};
+
+      // The strongest of the three neighbours, the middle one on ties.
+      int first_wins = int(magnitudes[0] > magnitudes[1]) &
+                       int(magnitudes[0] > magnitudes[2]);
+      int last_wins = int(magnitudes[2] > magnitudes[0]) &
+                      int(magnitudes[2] > magnitudes[1]);
+      int next = 1 - first_wins + last_wins;
+
+      std::size_t next_offset = offset + neighbor_offsets[next];
+      float next_magnitude = magnitudes[next];
+
+      if (next_magnitude == 0.0f) {
+        break;
+      }
+
+      const NeighborStep& step = kNeighborSteps[aim][next];
+      if (y + step.dy < row_begin || y + step.dy >= row_end) {
+        complete = false;
+        break;
+      }
+
+      if ((edge_map[next_offset] & kEdgeBit) != 0) {
+        walks.stop_offsets[walks.stop_count++] = next_offset;
+        break;
+      }
+
+      edge_map[next_offset] |= kEdgeBit;
+      x += step.dx;
+      y += step.dy;
+      walk.push_back(Edgel{Position(x, y), next_magnitude});
+
+      int next_direction = int(planes.directionAt(next_offset));
+      aim = kNextAims[aim][next][next_direction];
+      offset = next_offset;
     }
   }
 
-  if (neighbor_magnitudes[0] > neighbor_magnitudes[1] &&
-      neighbor_magnitudes[0] > neighbor_magnitudes[2]) {
-    return neighbor_positions[0];
-  } else if (neighbor_magnitudes[2] > neighbor_magnitudes[0] &&
-             neighbor_magnitudes[2] > neighbor_magnitudes[1]) {
-    return neighbor_positions[2];
+  return complete;
+}
+
+// Appends the chain of a linked anchor: the backward walk reversed, the
+// anchor, then the forward walk.
+void EdgeDrawing::AddSegment(const Edgel& anchor, const AnchorWalks& walks) {
+  edge_pixels_.push_back(get_offset(anchor.position));
+  for (const auto& pixel : walks.forward) {
+    edge_pixels_.push_back(get_offset(pixel.position));
+  }
+  for (const auto& pixel : walks.backward) {
+    edge_pixels_.push_back(get_offset(pixel.position));
+  }
+
+  edge_segments_.AddPixels(walks.backward.rbegin(), walks.backward.rend());
+  edge_segments_.AddPixel(anchor);
+  edge_segments_.AddPixels(walks.forward.begin(), walks.forward.end());
+  edge_segments_.CloseSegment();
+  if (stream_linked_segments_ == true) {
+    StreamSegment(edge_segments_);
+  }
+}
+
+// Hands the segment last closed in store to the streaming callback.
+void EdgeDrawing::StreamSegment(const EdgeSegmentStore& store) {
+  if (edge_segment_callback_) {
+    edge_segment_callback_(store[store.size() - 1]);
+  }
+}
+
+GradientPlanes EdgeDrawing::gradient_planes() {
+  return GradientPlanes{magnitude_.buffer(), direction_map_.buffer()};
+}
+
+CompactGradientPlanes EdgeDrawing::compact_gradient_planes() {
+  return CompactGradientPlanes{compact_magnitude_.buffer()};
+}
+
+float EdgeDrawing::magnitudeAt(std::size_t offset) {
+  if (compact_gradient_ == true) {
+    return compact_gradient_planes().magnitudeAt(offset);
   } else {
-    return neighbor_positions[1];
+    return magnitude_.buffer()[offset];
   }
 }
 
-float EdgeDrawing::magnitudeAt(Position position) {
-  std::size_t offset = get_offset(position);
-  return magnitude_.buffer()[offset];
+void EdgeDrawing::gradientAt(std::size_t offset, int& gx, int& gy) {
+  if (compact_gradient_ == true) {
+    gx = compact_gx_.buffer()[offset];
+    gy = compact_gy_.buffer()[offset];
+  } else {
+    gx = gx_.buffer()[offset];
+    gy = gy_.buffer()[offset];
+  }
 }
 
-EdgeDirection EdgeDrawing::directionAt(Position position) {
-  std::size_t offset = get_offset(position);
-  return (EdgeDirection)(direction_map_.buffer()[offset]);
+// The map the linker marks: with float planes the edge flag shares the
+// direction byte, the compact planes have no spare bit and use a separate map.
+unsigned char* EdgeDrawing::edge_map() {
+  if (compact_gradient_ == true) {
+    return edge_map_.buffer();
+  } else {
+    return direction_map_.buffer();
+  }
 }
 
-void EdgeDrawing::set_direction(Position position, EdgeDirection direction) {
-  std::size_t offset = get_offset(position);
-  direction_map_.buffer()[offset] = (unsigned char)direction;
+void EdgeDrawing::ClearEdgeMap() {
+  // The direction plane is rewritten for every pixel that can be linked, which
+  // clears its edge flags as a side effect.
+  if (compact_gradient_ == false) {
+    edge_pixels_.clear();
+    return;
+  }
+
+  // Only the pixels linked in the previous frame are set, so unless the frame
+  // size changed those are all that need clearing.
+  if (edge_map_.width() == width_ && edge_map_.height() == height_) {
+    for (auto offset : edge_pixels_) {
+      edge_map_.buffer()[offset] = 0;
+    }
+  } else {
+    edge_map_.Reset(width_, height_);
+  }
+
+  edge_pixels_.clear();
 }
 
 void EdgeDrawing::set_edge(Position position, bool value) {
   std::size_t offset = get_offset(position);
   if (value == true) {
-    edge_map_.buffer()[offset] = 1;
+    edge_map()[offset] |= kEdgeBit;
+    edge_pixels_.push_back(offset);
   } else {
-    edge_map_.buffer()[offset] = 0;
+    edge_map()[offset] &= ~kEdgeBit;
   }
 }
 
 inline bool EdgeDrawing::is_edge(Position position) {
   std::size_t offset = get_offset(position);
-  if (edge_map_.buffer()[offset] == 1) {
+  if ((edge_map()[offset] & kEdgeBit) != 0) {
     return true;
   } else {
     return false;
@@ -281,7 +875,43 @@ inline bool EdgeDrawing::is_edge(Position position) {
 }
 
 std::size_t EdgeDrawing::get_offset(Position position) {
-  return width_ * position.y + position.x;
+  return stride_ * position.y + position.x;
+}
+
+// Orientation of the line along (dx, dy), modulo pi, in kOrientationUnits
+// units: the vector is folded into the first octant, where a ratio table
+// stands in for atan.
+unsigned char EdgeDrawing::QuantizeOrientation(float dx, float dy) {
+  if (dy < 0.0f || (dy == 0.0f && dx < 0.0f)) {
+    dx = -dx;
+    dy = -dy;
+  }
+
+  const std::vector<unsigned char>& table = OrientationRatioTable();
+  float abs_dx = abs(dx);
+  int orientation = 0;
+
+  if (dy <= abs_dx) {
+    if (abs_dx == 0.0f) {
+      return 0;
+    }
+    orientation = table[int(dy / abs_dx * kOrientationRatioSteps + 0.5f)];
+  } else {
+    orientation = kOrientationUnits / 2 -
+                  table[int(abs_dx / dy * kOrientationRatioSteps + 0.5f)];
+  }
+
+  if (dx < 0.0f) {
+    orientation = kOrientationUnits - orientation;
+  }
+
+  return (unsigned char)(orientation & (kOrientationUnits - 1));
+}
+
+unsigned char EdgeDrawing::OrientationDifference(unsigned char a,
+                                                 unsigned char b) {
+  int difference = (int(a) - int(b)) & (kOrientationUnits - 1);
+  return (unsigned char)std::min(difference, kOrientationUnits - difference);
 }
 
 bool EdgeDrawing::isValidPosition(Position position) {
@@ -1,10 +1,13 @@
 #ifndef EDGE_DRAWING_H_
 #define EDGE_DRAWING_H_
 
+#include <functional>
 #include <memory>
 
+#include "detection_visitor.h"
 #include "image/image.h"
 #include "primitives/edge_segment.h"
+#include "worker_pool.h"
 
 enum class EdgeDirection : unsigned char {
   VerticalEdge = 0,
@@ -18,50 +21,207 @@ enum class ConnectingAim : unsigned char {
   Down = 3
 };
 
+// Read-only accessors over the gradient planes, so that anchor extraction and
+// linking can be instantiated for either storage layout.
+//
+// The direction plane holds one state byte per pixel: the EdgeDirection in
+// kDirectionMask and the linked flag in kEdgeBit, so a linking step reads
+// both with one access.
+struct GradientPlanes {
+  static const unsigned char kDirectionMask = 0x01;
+  static const unsigned char kEdgeBit = 0x02;
+
+  const float* magnitude;
+  const unsigned char* direction;
+
+  float magnitudeAt(std::size_t offset) const { return magnitude[offset]; }
+  EdgeDirection directionAt(std::size_t offset) const {
+    return (EdgeDirection)(direction[offset] & kDirectionMask);
+  }
+};
+
+// Compact layout: the magnitude is quantized to 1/kMagnitudeScale in the low
+// 15 bits and the edge direction is kept in the top bit of the same word.
+struct CompactGradientPlanes {
+  static const int kMagnitudeScale = 16;
+  static const unsigned short kDirectionBit = 0x8000;
+  static const unsigned short kMagnitudeMask = 0x7fff;
+
+  const unsigned short* magnitude;
+
+  float magnitudeAt(std::size_t offset) const {
+    return float(magnitude[offset] & kMagnitudeMask) *
+           (1.0f / float(kMagnitudeScale));
+  }
+  EdgeDirection directionAt(std::size_t offset) const {
+    return (magnitude[offset] & kDirectionBit) != 0
+               ? EdgeDirection::HorizontalEdge
+               : EdgeDirection::VerticalEdge;
+  }
+};
+
 class EdgeDrawing {
+ public:
+  // Receives each final segment as soon as it is complete, on the thread
+  // that runs the detection. The view is only valid during the call, so a
+  // consumer on another thread has to copy the pixels it wants to keep.
+  typedef std::function<void(const EdgeSegment&)> EdgeSegmentCallback;
+
  public:
   EdgeDrawing(float magnitude_threshold, float anchor_threshold,
               int anchor_extraction_interval);
+  virtual ~EdgeDrawing() {}
 
  public:
   void set_verbose(bool verbose);
-  void DetectEdge(GrayImage& image);
-  std::list<EdgeSegment> edge_segments();
+  void set_gaussian_smoothing(std::size_t size, float sigma);
+  void set_compact_gradient(bool compact);
+  void set_thread_count(std::size_t thread_count);
+  void set_edge_segment_callback(EdgeSegmentCallback callback);
+  void set_orientation_map(bool enabled);
+  void DetectEdge(GrayImageView image);
+
+  // Results are owned by the detector and hold the latest finished
+  // detection. Each call builds into separate buffers and swaps them in when
+  // it finishes, so the previous results stay valid while the next call runs
+  // and are replaced only at its end.
+  const EdgeSegmentStore& edge_segments() const;
+  virtual void Accept(DetectionVisitor& visitor) const;
+  GrayImage& smoothed_image();
 
  protected:
-  void PrepareEdgeMap(GrayImage& image);
+  void DetectEdgeSegments(GrayImageView image);
+  void PublishEdgeSegments();
+  void PrepareEdgeMap(GrayImageView image);
+  void PrepareStreamedEdgeMap(GrayImageView image);
+  void PrepareGradientRow(const unsigned char* above,
+                          const unsigned char* current,
+                          const unsigned char* below, int width, int y);
+  void PrepareOrientationMap();
   void ExtractAnchor();
   void ConnectAnchor();
-  Position FindNextConnectingPosition(Position current,
-                                      ConnectingAim direction);
-
-  float magnitudeAt(Position position);
-  EdgeDirection directionAt(Position position);
-  void set_direction(Position position, EdgeDirection direction);
 
+  template <typename Planes>
+  void ExtractAnchor(const Planes& planes);
+  template <typename Planes>
+  int ExtractAnchorBlock(const Planes& planes, int y);
+  // Pixels of the two walks from one anchor, and the offsets of the edge
+  // pixels that stopped them.
+  struct AnchorWalks {
+    std::vector<Edgel> forward;
+    std::vector<Edgel> backward;
+    std::size_t stop_offsets[2];
+    int stop_count = 0;
+  };
+
+  // Linking result of one anchor within its tile; the chain is
+  // pixels[begin, end) of the tile.
+  struct AnchorLink {
+    bool skipped;
+    bool complete;
+    std::size_t begin;
+    std::size_t end;
+    std::size_t stop_offsets[2];
+    int stop_count;
+  };
+
+  struct LinkTileState {
+    int row_begin = 0;
+    int row_end = 0;
+    std::vector<std::size_t> anchors;
+    std::vector<AnchorLink> links;
+    std::vector<Edgel> pixels;
+    AnchorWalks walks;
+  };
+
+  template <typename Planes>
+  void ConnectAnchor(const Planes& planes);
+  template <typename Planes>
+  void ConnectAnchorInTiles(const Planes& planes);
+  template <typename Planes>
+  void LinkTile(const Planes& planes, LinkTileState& tile);
+  bool CommitAnchorLink(const LinkTileState& tile, const AnchorLink& link);
+  template <typename Planes>
+  bool LinkAnchor(const Planes& planes, const Edgel& anchor,
+                  unsigned char* edge_map, int row_begin, int row_end,
+                  AnchorWalks& walks);
+  void AddSegment(const Edgel& anchor, const AnchorWalks& walks);
+  void StreamSegment(const EdgeSegmentStore& store);
+
+  GradientPlanes gradient_planes();
+  CompactGradientPlanes compact_gradient_planes();
+  float magnitudeAt(std::size_t offset);
+  void gradientAt(std::size_t offset, int& gx, int& gy);
+
+  unsigned char* edge_map();
+  void ClearEdgeMap();
   void set_edge(Position position, bool value);
   bool is_edge(Position position);
 
   std::size_t get_offset(Position position);
   bool isValidPosition(Position position);
 
+  static unsigned char QuantizeOrientation(float dx, float dy);
+  static unsigned char OrientationDifference(unsigned char a,
+                                             unsigned char b);
+
  protected:
+  static const std::size_t kGuardBorder = 1;
+  static const unsigned char kEdgeBit = GradientPlanes::kEdgeBit;
+  static const std::size_t kLinkTilesPerThread = 1;
+  static const std::size_t kMinimumLinkTileRows = 64;
+  // Orientations are taken modulo pi in units of pi / 256.
+  static const int kOrientationUnits = 256;
+
   std::size_t width_;
   std::size_t height_;
+  std::size_t stride_;
 
   float magnitude_threshold_;
   float anchor_threshold_;
   int anchor_extraction_interval_;
 
+  std::size_t gaussian_size_ = 0;
+  float gaussian_sigma_ = 0.0f;
+  std::vector<float> gaussian_kernel_;
+
+  bool compact_gradient_ = false;
+
  protected:
+  GrayImage smoothed_image_;
   IntImage gx_;
   IntImage gy_;
   FloatImage magnitude_;
   Image<unsigned char> direction_map_;
-
-  std::list<Edgel> anchors_;
+  // Level-line orientation of every pixel, filled when enabled.
+  Image<unsigned char> orientation_map_;
+  bool orientation_map_enabled_ = false;
+
+  Image<short> compact_gx_;
+  Image<short> compact_gy_;
+  Image<unsigned short> compact_magnitude_;
+  std::vector<int> row_gx_;
+  std::vector<int> row_gy_;
+  std::vector<float> row_magnitude_;
+  std::vector<float> gaussian_column_sums_;
+  std::vector<const unsigned char*> gaussian_rows_;
+
+  std::vector<Edgel> anchors_;
+  std::vector<Edgel> row_anchors_;
   Image<unsigned char> edge_map_;
-  std::list<EdgeSegment> edge_segments_;
+  std::vector<std::size_t> edge_pixels_;
+  std::ptrdiff_t neighbor_offsets_[4][3];
+  AnchorWalks anchor_walks_;
+  std::size_t thread_count_ = 1;
+  WorkerPool link_workers_;
+  std::vector<LinkTileState> link_tiles_;
+  std::vector<std::size_t> link_tile_cursors_;
+  Image<unsigned char> tile_edge_map_;
+  EdgeSegmentStore edge_segments_;
+  EdgeSegmentStore published_edge_segments_;
+  EdgeSegmentCallback edge_segment_callback_;
+  // Linked chains are final unless a derived detector filters them first.
+  bool stream_linked_segments_ = true;
 
   bool verbose_ = false;
 };
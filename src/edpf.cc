@@ -1,12 +1,24 @@
 #include "edpf.h"
 
 #include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <limits>
 
+#include "fast_math.h"
 #include "util.h"
 
-EDPF::EDPF() : EdgeDrawing(EDPF::GradientThreshold(), 0.0f, 1) {}
+EDPF::EDPF() : EdgeDrawing(EDPF::GradientThreshold(), 0.0f, 1) {
+  // Only the segments passing ValidateSegments are streamed.
+  stream_linked_segments_ = false;
+}
+
+void EDPF::DetectEdge(GrayImageView image) {
+  DetectEdgeSegments(image);
+  PublishEdgeSegments();
+}
 
-void EDPF::DetectEdge(GrayImage &image) {
+void EDPF::DetectEdgeSegments(GrayImageView image) {
   width_ = image.width();
   height_ = image.height();
 
@@ -35,66 +47,105 @@ void EDPF::DetectEdge(GrayImage &image) {
   STOPWATCHSTOP(verbose_, "EDPF::ValidateSegments - ")
 }
 
+// Anchor magnitudes are positive, so their IEEE bit patterns order the same
+// way as the values. An LSD radix sort on the complemented bits is stable and
+// gives descending magnitude with ties kept in extraction order, exactly like
+// a stable comparison sort.
 void EDPF::SortAnchors() {
-  anchors_.sort([=](const Edgel &a, const Edgel &b) -> bool {
-    return a.magnitude > b.magnitude;
-  });
-}
+  const int kRadixBits = 11;
+  const int kPassCount = 3;
+  const std::uint32_t kBucketCount = 1u << kRadixBits;
+  const std::uint32_t kBucketMask = kBucketCount - 1;
+
+  std::size_t anchor_count = anchors_.size();
+  if (anchor_count <= 1) {
+    return;
+  }
 
-void EDPF::PrepareNFA() {
-  magnitude_cumulative_distribution_.clear();
-  magnitude_cumulative_distribution_.reserve(width_ * height_);
-  std::chrono::system_clock::time_point start;
-  std::chrono::duration<double> sec;
+  radix_keys_.resize(anchor_count);
+  radix_histogram_.assign(kPassCount * kBucketCount, 0);
 
-  start = std::chrono::system_clock::now();
+  for (std::size_t i = 0; i < anchor_count; ++i) {
+    std::uint32_t bits = 0;
+    memcpy(&bits, &anchors_[i].magnitude, sizeof(bits));
+    radix_keys_[i] = ~bits;
 
-  std::vector<float> magnitudes;
-  magnitudes.insert(magnitudes.end(), magnitude_.buffer(),
-                    magnitude_.buffer() + width_ * height_);
+    for (auto pass = 0; pass < kPassCount; ++pass) {
+      std::uint32_t digit =
+          (radix_keys_[i] >> (pass * kRadixBits)) & kBucketMask;
+      radix_histogram_[pass * kBucketCount + digit]++;
+    }
+  }
 
-  std::sort(magnitudes.begin(), magnitudes.end());
+  sorted_anchors_.resize(anchor_count, anchors_.front());
+  sorted_radix_keys_.resize(anchor_count);
 
-  float last_value = 0.0f;
-  int current_index = -1;
-  int zero_count = 0;
-  for (auto m : magnitudes) {
-    if (m == 0.0f) {
-      zero_count++;
+  for (auto pass = 0; pass < kPassCount; ++pass) {
+    std::size_t* histogram = radix_histogram_.data() + pass * kBucketCount;
+    int shift = pass * kRadixBits;
+
+    // A digit shared by every anchor leaves the order unchanged.
+    std::uint32_t first_digit = (radix_keys_[0] >> shift) & kBucketMask;
+    if (histogram[first_digit] == anchor_count) {
       continue;
     }
 
-    if (m != last_value) {
-      magnitude_cumulative_distribution_.push_back(std::make_pair(m, 1.0f));
-      current_index++;
-      last_value = m;
-    } else {
-      magnitude_cumulative_distribution_[current_index].second += 1.0f;
+    std::size_t position = 0;
+    for (std::uint32_t digit = 0; digit < kBucketCount; ++digit) {
+      std::size_t count = histogram[digit];
+      histogram[digit] = position;
+      position += count;
+    }
+
+    for (std::size_t i = 0; i < anchor_count; ++i) {
+      std::uint32_t digit = (radix_keys_[i] >> shift) & kBucketMask;
+      std::size_t destination = histogram[digit]++;
+      sorted_anchors_[destination] = anchors_[i];
+      sorted_radix_keys_[destination] = radix_keys_[i];
     }
+
+    anchors_.swap(sorted_anchors_);
+    radix_keys_.swap(sorted_radix_keys_);
   }
-  int count = magnitudes.size() - zero_count;
-
-  std::sort(magnitude_cumulative_distribution_.begin(),
-            magnitude_cumulative_distribution_.end(),
-            [](const std::pair<float, float> &a,
-               const std::pair<float, float> &b) { return a.first > b.first; });
-
-  if (magnitude_cumulative_distribution_.size() > 0) {
-    magnitude_cumulative_distribution_[0].second /= float(count);
-    magnitude_cumulative_distribution_table_.insert(
-        std::make_pair(magnitude_cumulative_distribution_[0].first,
-                       magnitude_cumulative_distribution_[0].second));
-    for (int i = 1; i < magnitude_cumulative_distribution_.size(); ++i) {
-      magnitude_cumulative_distribution_[i].second =
-          magnitude_cumulative_distribution_[i - 1].second +
-          (magnitude_cumulative_distribution_[i].second / float(count));
-
-      magnitude_cumulative_distribution_table_.insert(
-          std::make_pair(magnitude_cumulative_distribution_[i].first,
-                         magnitude_cumulative_distribution_[i].second));
+}
+
+// The gradient distribution is kept as a histogram over magnitudes quantized
+// like the compact gradient planes, so both plane types share one table and
+// the compact one is binned exactly.
+void EDPF::PrepareNFA() {
+  magnitude_histogram_.assign(kMagnitudeBinCount, 0);
+
+  if (compact_gradient_ == true) {
+    for (std::size_t y = 0; y < height_; ++y) {
+      const unsigned short *row = compact_magnitude_.row(y);
+      for (std::size_t x = 0; x < width_; ++x) {
+        magnitude_histogram_[row[x] & CompactGradientPlanes::kMagnitudeMask]++;
+      }
+    }
+  } else {
+    for (std::size_t y = 0; y < height_; ++y) {
+      const float *row = magnitude_.row(y);
+      for (std::size_t x = 0; x < width_; ++x) {
+        magnitude_histogram_[MagnitudeBin(row[x])]++;
+      }
     }
+  }
 
-    magnitude_cumulative_distribution_.shrink_to_fit();
+  // log H(m), where H(m) is the probability that a non-zero magnitude is at
+  // least m. Bin 0 only holds zero magnitudes, which do not take part, and
+  // empty bins share the value of the bin above.
+  std::size_t count = width_ * height_ - magnitude_histogram_[0];
+  magnitude_log_cumulative_distribution_.resize(kMagnitudeBinCount);
+  magnitude_log_cumulative_distribution_[0] = 0.0f;
+
+  std::size_t cumulative_count = 0;
+  float log_H = -std::numeric_limits<float>::infinity();
+  for (int bin = kMagnitudeBinCount - 1; bin > 0; --bin) {
+    if (magnitude_histogram_[bin] > 0) {
+      cumulative_count += magnitude_histogram_[bin];
+      log_H = FastMath::Log(float(cumulative_count) / float(count));
+    }
+    magnitude_log_cumulative_distribution_[bin] = log_H;
   }
 
   N_p = 0;
@@ -102,12 +153,13 @@ void EDPF::PrepareNFA() {
     N_p += (segment.size() * (segment.size() - 1));
   }
   N_p /= 2;
+  log_N_p_ = log(float(N_p));
 }
 
 void EDPF::ValidateSegments() {
-  std::list<EdgeSegment> valid_edge_segments;
+  valid_edge_segments_.clear();
 
-  for (auto &segment : edge_segments_) {
+  for (const auto &segment : edge_segments_) {
     int segment_length = segment.size();
 
     if (segment_length <= 1) {
@@ -121,90 +173,109 @@ void EDPF::ValidateSegments() {
                                      });
 
       if (IsValidSegment(min_it->magnitude, segment_length) == true) {
-        EdgeSegment valid_edge_segment;
-        valid_edge_segment.splice(valid_edge_segment.end(), segment,
-                                  segment.begin(), segment.end());
-
-        valid_edge_segments.push_back(valid_edge_segment);
+        valid_edge_segments_.AddSegment(segment);
+        StreamSegment(valid_edge_segments_);
         continue;
       }
     }
 
-    std::list<std::pair<EdgeSegment::iterator, EdgeSegment::iterator>>
-        valid_candidates;
-    valid_candidates.push_back(std::make_pair(segment.begin(), segment.end()));
+    BuildMinimumTree(segment);
+
+    // Sub-segments still to be tested, consumed in FIFO order. Each range's
+    // weakest pixel is its root in the minimum tree, so a split is O(1).
+    valid_candidates_.clear();
+    valid_candidates_.push_back(
+        SegmentRange{0, segment_length, minimum_tree_root_});
 
-    while (valid_candidates.size() > 0) {
-      auto sub_segment_begin_to_end = valid_candidates.front();
-      valid_candidates.pop_front();
+    for (std::size_t i = 0; i < valid_candidates_.size(); ++i) {
+      SegmentRange range = valid_candidates_[i];
 
-      int sub_segment_length = std::distance(sub_segment_begin_to_end.first,
-                                             sub_segment_begin_to_end.second);
+      int sub_segment_length = range.end - range.begin;
 
       if (sub_segment_length <= 1) {
         continue;
       }
 
-      auto min_position = std::min_element(sub_segment_begin_to_end.first,
-                                           sub_segment_begin_to_end.second,
-                                           [](const auto &a, const auto &b) {
-                                             return a.magnitude < b.magnitude;
-                                           });
-
-      if (IsValidSegment(min_position->magnitude, sub_segment_length) == true) {
-        EdgeSegment valid_edge_segment;
-        valid_edge_segment.splice(valid_edge_segment.end(), segment,
-                                  sub_segment_begin_to_end.first,
-                                  sub_segment_begin_to_end.second);
-        valid_edge_segments.push_back(valid_edge_segment);
+      const Edgel &min_edgel = segment[range.minimum];
+
+      if (IsValidSegment(min_edgel.magnitude, sub_segment_length) == true) {
+        valid_edge_segments_.AddSegment(EdgeSegment(
+            segment.begin() + range.begin, segment.begin() + range.end));
+        StreamSegment(valid_edge_segments_);
         continue;
       }
 
-      int left_distance =
-          std::distance(sub_segment_begin_to_end.first, min_position);
+      int left_distance = range.minimum - range.begin;
       int right_distance = sub_segment_length - left_distance - 1;
 
       if (left_distance > 1) {
-        valid_candidates.push_back(
-            std::make_pair(sub_segment_begin_to_end.first, min_position));
+        valid_candidates_.push_back(SegmentRange{
+            range.begin, range.minimum, left_children_[range.minimum]});
       }
 
       if (right_distance > 1) {
-        min_position++;
-        valid_candidates.push_back(
-            std::make_pair(min_position, sub_segment_begin_to_end.second));
+        valid_candidates_.push_back(SegmentRange{
+            range.minimum + 1, range.end, right_children_[range.minimum]});
       }
     }
   }
 
-  edge_segments_ = valid_edge_segments;
+  edge_segments_.swap(valid_edge_segments_);
 }
 
-bool EDPF::IsValidSegment(EdgeSegment &segment) {
+// Builds the Cartesian tree of the segment magnitudes: every node is the
+// weakest pixel of its subtree's range, the leftmost one on ties, as
+// std::min_element would pick.
+void EDPF::BuildMinimumTree(const EdgeSegment &segment) {
+  int segment_length = segment.size();
+
+  left_children_.assign(segment_length, -1);
+  right_children_.assign(segment_length, -1);
+  minimum_tree_stack_.clear();
+
+  for (auto i = 0; i < segment_length; ++i) {
+    int last_popped = -1;
+    while (minimum_tree_stack_.empty() == false &&
+           segment[minimum_tree_stack_.back()].magnitude >
+               segment[i].magnitude) {
+      last_popped = minimum_tree_stack_.back();
+      minimum_tree_stack_.pop_back();
+    }
+
+    left_children_[i] = last_popped;
+    if (minimum_tree_stack_.empty() == false) {
+      right_children_[minimum_tree_stack_.back()] = i;
+    }
+
+    minimum_tree_stack_.push_back(i);
+  }
+
+  minimum_tree_root_ = minimum_tree_stack_.front();
+}
+
+bool EDPF::IsValidSegment(const EdgeSegment &segment) {
   auto min_it = std::min_element(
       segment.begin(), segment.end(),
       [](const auto &a, const auto &b) { return a.magnitude < b.magnitude; });
 
-  float NPA = get_NFA(min_it->magnitude, int(segment.size()));
-  if (NPA < 1.0) {
-    return true;
-  } else {
-    return false;
-  }
+  return IsValidSegment(min_it->magnitude, int(segment.size()));
 }
 
+// NFA = N_p * H^length < 1, tested in log space.
 bool EDPF::IsValidSegment(float min_value, int segment_size) {
-  float NPA = get_NFA(min_value, segment_size);
-  if (NPA < 1.0) {
+  if (get_log_NFA(min_value, segment_size) < 0.0f) {
     return true;
   } else {
     return false;
   }
 }
 
-float EDPF::get_NFA(float magnitude, int segment_length) {
-  float H = magnitude_cumulative_distribution_table_[magnitude];
+int EDPF::MagnitudeBin(float magnitude) {
+  return std::min(int(magnitude * float(kMagnitudeScale) + 0.5f),
+                  kMagnitudeBinCount - 1);
+}
 
-  float NFA = float(N_p) * exp(float(segment_length) * log(H));
-  return NFA;
+float EDPF::get_log_NFA(float magnitude, int segment_length) {
+  float log_H = magnitude_log_cumulative_distribution_[MagnitudeBin(magnitude)];
+  return float(segment_length) * log_H + log_N_p_;
 }
@@ -1,7 +1,7 @@
 #ifndef EDPF_H_
 #define EDPF_H_
 
-#include <map>
+#include <cstdint>
 
 #include "edge_drawing.h"
 #include "image/image.h"
@@ -11,24 +11,49 @@ class EDPF : public EdgeDrawing {
   EDPF();
 
  public:
-  void DetectEdge(GrayImage& image);
+  void DetectEdge(GrayImageView image);
 
  public:
   static float GradientThreshold() { return (sqrt(8 * 8 + 8 * 8)); }
 
  protected:
+  void DetectEdgeSegments(GrayImageView image);
   void SortAnchors();
   void PrepareNFA();
   void ValidateSegments();
-  bool IsValidSegment(EdgeSegment& segment);
+  void BuildMinimumTree(const EdgeSegment& segment);
+  bool IsValidSegment(const EdgeSegment& segment);
   bool IsValidSegment(float min_value, int segment_size);
-  float get_NFA(float magnitude, int segment_length);
+  float get_log_NFA(float magnitude, int segment_length);
+
+  static int MagnitudeBin(float magnitude);
 
  protected:
-  std::vector<std::pair<float, float>> magnitude_cumulative_distribution_;
-  std::map<float, float> magnitude_cumulative_distribution_table_;
+  static const int kMagnitudeScale = CompactGradientPlanes::kMagnitudeScale;
+  static const int kMagnitudeBinCount =
+      CompactGradientPlanes::kMagnitudeMask + 1;
+
+  std::vector<std::size_t> magnitude_histogram_;
+  std::vector<float> magnitude_log_cumulative_distribution_;
+  std::vector<std::uint32_t> radix_keys_;
+  std::vector<std::uint32_t> sorted_radix_keys_;
+  std::vector<std::size_t> radix_histogram_;
+  std::vector<Edgel> sorted_anchors_;
+  struct SegmentRange {
+    int begin;
+    int end;
+    int minimum;
+  };
+
+  std::vector<SegmentRange> valid_candidates_;
+  std::vector<int> left_children_;
+  std::vector<int> right_children_;
+  std::vector<int> minimum_tree_stack_;
+  int minimum_tree_root_ = -1;
+  EdgeSegmentStore valid_edge_segments_;
 
   int N_p = 0;
+  float log_N_p_ = 0.0f;
 };
 
 #endif
@@ -0,0 +1,152 @@
+#include "fast_math.h"
+
+#if defined(EDCIRCLE_FAST_MATH) &&           \
+    (defined(__SSE2__) || defined(_M_X64) || \
+     (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#define FAST_MATH_USE_SSE2
+#include <emmintrin.h>
+#endif
+
+#ifdef FAST_MATH_USE_SSE2
+
+namespace {
+
+// Each lane function follows its scalar counterpart in fast_math.h operation
+// by operation, with the conditionals turned into masks.
+
+inline __m128 Select(__m128 mask, __m128 if_true, __m128 if_false) {
+  return _mm_or_ps(_mm_and_ps(mask, if_true), _mm_andnot_ps(mask, if_false));
+}
+
+inline __m128 SignBit() { return _mm_set1_ps(-0.0f); }
+
+inline __m128 Abs(__m128 x) { return _mm_andnot_ps(SignBit(), x); }
+
+inline __m128 Polynomial(__m128 x, const float* coefficients, int count) {
+  __m128 result = _mm_set1_ps(coefficients[count - 1]);
+  for (int i = count - 2; i >= 0; --i) {
+    result = _mm_add_ps(_mm_set1_ps(coefficients[i]), _mm_mul_ps(x, result));
+  }
+  return result;
+}
+
+inline __m128 Atan2Lanes(__m128 y, __m128 x) {
+  static const float kCoefficients[5] = {0.9998660f, -0.3302995f, 0.1801410f,
+                                         -0.0851330f, 0.0208351f};
+  const __m128 zero = _mm_setzero_ps();
+
+  __m128 abs_x = Abs(x);
+  __m128 abs_y = Abs(y);
+  __m128 x_is_larger = _mm_cmpgt_ps(abs_x, abs_y);
+  __m128 larger = Select(x_is_larger, abs_x, abs_y);
+  __m128 smaller = Select(x_is_larger, abs_y, abs_x);
+  __m128 t =
+      _mm_and_ps(_mm_cmpgt_ps(larger, zero), _mm_div_ps(smaller, larger));
+  __m128 angle = _mm_mul_ps(t, Polynomial(_mm_mul_ps(t, t), kCoefficients, 5));
+
+  angle = Select(_mm_cmpgt_ps(abs_y, abs_x),
+                 _mm_sub_ps(_mm_set1_ps(1.57079633f), angle), angle);
+  angle = Select(_mm_cmplt_ps(x, zero),
+                 _mm_sub_ps(_mm_set1_ps(3.14159265f), angle), angle);
+  return _mm_xor_ps(angle, _mm_and_ps(_mm_cmplt_ps(y, zero), SignBit()));
+}
+
+inline __m128 AcosLanes(__m128 x) {
+  static const float kCoefficients[8] = {
+      1.5707963050f, -0.2145988016f, 0.0889789874f,  -0.0501743046f,
+      0.0308918810f, -0.0170881256f, 0.0066700901f, -0.0012624911f};
+
+  __m128 abs_x = Abs(x);
+  __m128 angle =
+      _mm_mul_ps(_mm_sqrt_ps(_mm_sub_ps(_mm_set1_ps(1.0f), abs_x)),
+                 Polynomial(abs_x, kCoefficients, 8));
+
+  return Select(_mm_cmplt_ps(x, _mm_setzero_ps()),
+                _mm_sub_ps(_mm_set1_ps(3.14159265f), angle), angle);
+}
+
+inline void SinCosLanes(__m128 x, __m128& sine, __m128& cosine) {
+  static const float kSineCoefficients[5] = {
+      1.0f, -1.0f / 6.0f, 1.0f / 120.0f, -1.0f / 5040.0f, 1.0f / 362880.0f};
+  static const float kCosineCoefficients[5] = {
+      1.0f, -0.5f, 1.0f / 24.0f, -1.0f / 720.0f, 1.0f / 40320.0f};
+
+  // floor() without SSE4.1: truncate, then step down where that rounded up.
+  __m128 scaled =
+      _mm_add_ps(_mm_mul_ps(x, _mm_set1_ps(0.636619772f)), _mm_set1_ps(0.5f));
+  __m128i quadrant = _mm_cvttps_epi32(scaled);
+  quadrant = _mm_add_epi32(
+      quadrant, _mm_castps_si128(
+                    _mm_cmpgt_ps(_mm_cvtepi32_ps(quadrant), scaled)));
+  __m128 k = _mm_cvtepi32_ps(quadrant);
+
+  __m128 r = _mm_sub_ps(x, _mm_mul_ps(k, _mm_set1_ps(1.5703125f)));
+  r = _mm_sub_ps(r, _mm_mul_ps(k, _mm_set1_ps(4.83751296997e-4f)));
+  r = _mm_sub_ps(r, _mm_mul_ps(k, _mm_set1_ps(7.54978995489e-8f)));
+  __m128 r2 = _mm_mul_ps(r, r);
+
+  __m128 s = _mm_add_ps(
+      r, _mm_mul_ps(_mm_mul_ps(r, r2),
+                    Polynomial(r2, kSineCoefficients + 1, 4)));
+  __m128 c = Polynomial(r2, kCosineCoefficients, 5);
+
+  const __m128i one = _mm_set1_epi32(1);
+  const __m128i two = _mm_set1_epi32(2);
+  __m128 odd = _mm_castsi128_ps(
+      _mm_cmpeq_epi32(_mm_and_si128(quadrant, one), one));
+  __m128 negate_sine = _mm_castsi128_ps(
+      _mm_cmpeq_epi32(_mm_and_si128(quadrant, two), two));
+  __m128 negate_cosine = _mm_castsi128_ps(_mm_cmpeq_epi32(
+      _mm_and_si128(_mm_add_epi32(quadrant, one), two), two));
+
+  sine = _mm_xor_ps(Select(odd, c, s), _mm_and_ps(negate_sine, SignBit()));
+  cosine =
+      _mm_xor_ps(Select(odd, s, c), _mm_and_ps(negate_cosine, SignBit()));
+}
+
+}  // namespace
+
+#endif
+
+void FastMath::Atan2(const float* y, const float* x, float* result,
+                     std::size_t count) {
+  std::size_t i = 0;
+#ifdef FAST_MATH_USE_SSE2
+  for (; i + 4 <= count; i += 4) {
+    _mm_storeu_ps(result + i,
+                  Atan2Lanes(_mm_loadu_ps(y + i), _mm_loadu_ps(x + i)));
+  }
+#endif
+  for (; i < count; ++i) {
+    result[i] = Atan2(y[i], x[i]);
+  }
+}
+
+void FastMath::Acos(const float* x, float* result, std::size_t count) {
+  std::size_t i = 0;
+#ifdef FAST_MATH_USE_SSE2
+  for (; i + 4 <= count; i += 4) {
+    _mm_storeu_ps(result + i, AcosLanes(_mm_loadu_ps(x + i)));
+  }
+#endif
+  for (; i < count; ++i) {
+    result[i] = Acos(x[i]);
+  }
+}
+
+void FastMath::SinCos(const float* x, float* sine, float* cosine,
+                      std::size_t count) {
+  std::size_t i = 0;
+#ifdef FAST_MATH_USE_SSE2
+  for (; i + 4 <= count; i += 4) {
+    __m128 sine_lanes;
+    __m128 cosine_lanes;
+    SinCosLanes(_mm_loadu_ps(x + i), sine_lanes, cosine_lanes);
+    _mm_storeu_ps(sine + i, sine_lanes);
+    _mm_storeu_ps(cosine + i, cosine_lanes);
+  }
+#endif
+  for (; i < count; ++i) {
+    SinCos(x[i], sine[i], cosine[i]);
+  }
+}
@@ -0,0 +1,183 @@
+#ifndef FAST_MATH_H_
+#define FAST_MATH_H_
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+// Elementary functions of the detection hot loops. The build selects the
+// implementation: by default they forward to <cmath>; with EDCIRCLE_FAST_MATH
+// defined they are polynomial approximations that skip the argument checks
+// and the careful range reduction of the library versions. Maximum errors of
+// the fast versions against double precision, measured over the stated
+// domains:
+//
+//   Atan2        1.2e-5 rad          Abramowitz & Stegun 4.4.47 on the ratio
+//                                    of the smaller to the larger |x|, |y|
+//   Acos, Asin   4.1e-7 rad          A&S 4.4.46, |x| <= 1
+//   Sin, Cos     1.1e-7 absolute     Cody-Waite reduction to [-pi/4, pi/4],
+//                                    |x| <= 1e4
+//   Log          7.7e-6 absolute     any normal positive x, one float ulp of
+//                                    the largest results
+//   Sqrt         exact in both modes, the hardware instruction is cheap.
+//
+// Zero, negative, denormal and infinite arguments of Log fall back to
+// <cmath>.
+//
+// The batched versions give the same results as the single ones. With
+// EDCIRCLE_FAST_MATH on SSE2 targets they run four lanes per instruction;
+// SinCos then needs |x| < 2^31 * pi / 2 for its range reduction.
+class FastMath {
+ public:
+  static float Atan2(float y, float x);
+  static float Acos(float x);
+  static float Asin(float x);
+  static float Sin(float x);
+  static float Cos(float x);
+  static void SinCos(float x, float& sine, float& cosine);
+  static float Log(float x);
+  static float Sqrt(float x) { return std::sqrt(x); }
+
+  static void Atan2(const float* y, const float* x, float* result,
+                    std::size_t count);
+  static void Acos(const float* x, float* result, std::size_t count);
+  static void SinCos(const float* x, float* sine, float* cosine,
+                     std::size_t count);
+};
+
+#ifdef EDCIRCLE_FAST_MATH
+
+inline float FastMath::Atan2(float y, float x) {
+  const float kPi = 3.14159265f;
+  const float kHalfPi = 1.57079633f;
+
+  float abs_x = std::fabs(x);
+  float abs_y = std::fabs(y);
+  float larger = abs_x > abs_y ? abs_x : abs_y;
+  float smaller = abs_x > abs_y ? abs_y : abs_x;
+  float t = larger > 0.0f ? smaller / larger : 0.0f;
+  float t2 = t * t;
+
+  float angle =
+      t * (0.9998660f +
+           t2 * (-0.3302995f +
+                 t2 * (0.1801410f + t2 * (-0.0851330f + t2 * 0.0208351f))));
+
+  angle = abs_y > abs_x ? kHalfPi - angle : angle;
+  angle = x < 0.0f ? kPi - angle : angle;
+  return y < 0.0f ? -angle : angle;
+}
+
+inline float FastMath::Acos(float x) {
+  const float kPi = 3.14159265f;
+
+  float abs_x = std::fabs(x);
+  float angle =
+      std::sqrt(1.0f - abs_x) *
+      (1.5707963050f +
+       abs_x *
+           (-0.2145988016f +
+            abs_x *
+                (0.0889789874f +
+                 abs_x *
+                     (-0.0501743046f +
+                      abs_x *
+                          (0.0308918810f +
+                           abs_x * (-0.0170881256f +
+                                    abs_x * (0.0066700901f +
+                                             abs_x * -0.0012624911f)))))));
+
+  return x < 0.0f ? kPi - angle : angle;
+}
+
+inline float FastMath::Asin(float x) { return 1.57079633f - Acos(x); }
+
+inline void FastMath::SinCos(float x, float& sine, float& cosine) {
+  // pi / 2 split so that k * kHalfPiHigh is exact for the reduced range.
+  const float kHalfPiHigh = 1.5703125f;
+  const float kHalfPiMiddle = 4.83751296997e-4f;
+  const float kHalfPiLow = 7.54978995489e-8f;
+
+  float k = std::floor(x * 0.636619772f + 0.5f);
+  float r = ((x - k * kHalfPiHigh) - k * kHalfPiMiddle) - k * kHalfPiLow;
+  float r2 = r * r;
+
+  float s = r + r * r2 *
+                    (-1.0f / 6.0f +
+                     r2 * (1.0f / 120.0f +
+                           r2 * (-1.0f / 5040.0f + r2 * (1.0f / 362880.0f))));
+  float c =
+      1.0f +
+      r2 * (-0.5f + r2 * (1.0f / 24.0f +
+                          r2 * (-1.0f / 720.0f + r2 * (1.0f / 40320.0f))));
+
+  int quadrant = int(std::int64_t(k) & 3);
+  float quadrant_sine = (quadrant & 1) != 0 ? c : s;
+  float quadrant_cosine = (quadrant & 1) != 0 ? s : c;
+
+  sine = (quadrant & 2) != 0 ? -quadrant_sine : quadrant_sine;
+  cosine = ((quadrant + 1) & 2) != 0 ? -quadrant_cosine : quadrant_cosine;
+}
+
+inline float FastMath::Sin(float x) {
+  float sine = 0.0f;
+  float cosine = 0.0f;
+  SinCos(x, sine, cosine);
+  return sine;
+}
+
+inline float FastMath::Cos(float x) {
+  float sine = 0.0f;
+  float cosine = 0.0f;
+  SinCos(x, sine, cosine);
+  return cosine;
+}
+
+inline float FastMath::Log(float x) {
+  if (!(x >= 1.17549435e-38f) || x == INFINITY) {
+    return std::log(x);
+  }
+
+  std::uint32_t bits = 0;
+  memcpy(&bits, &x, sizeof(bits));
+
+  int exponent = int((bits >> 23) & 0xff) - 127;
+  bits = (bits & 0x007fffff) | 0x3f800000;
+
+  float mantissa = 0.0f;
+  memcpy(&mantissa, &bits, sizeof(mantissa));
+
+  if (mantissa > 1.41421356f) {
+    mantissa *= 0.5f;
+    exponent++;
+  }
+
+  float t = (mantissa - 1.0f) / (mantissa + 1.0f);
+  float t2 = t * t;
+  float log_mantissa =
+      2.0f * t *
+      (1.0f + t2 * (1.0f / 3.0f +
+                    t2 * (1.0f / 5.0f + t2 * (1.0f / 7.0f + t2 / 9.0f))));
+
+  return float(exponent) * 0.693147181f + log_mantissa;
+}
+
+#else
+
+inline float FastMath::Atan2(float y, float x) { return std::atan2(y, x); }
+inline float FastMath::Acos(float x) { return std::acos(x); }
+inline float FastMath::Asin(float x) { return std::asin(x); }
+inline float FastMath::Sin(float x) { return std::sin(x); }
+inline float FastMath::Cos(float x) { return std::cos(x); }
+
+inline void FastMath::SinCos(float x, float& sine, float& cosine) {
+  sine = std::sin(x);
+  cosine = std::cos(x);
+}
+
+inline float FastMath::Log(float x) { return std::log(x); }
+
+#endif
+
+#endif
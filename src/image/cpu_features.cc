@@ -0,0 +1,94 @@
+#include "cpu_features.h"
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#define CPU_FEATURES_X86
+#elif defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#define CPU_FEATURES_X86
+#endif
+
+#ifdef CPU_FEATURES_X86
+namespace {
+
+void cpuid(int leaf, int subleaf, unsigned int registers[4]) {
+#ifdef _MSC_VER
+  int values[4];
+  __cpuidex(values, leaf, subleaf);
+  for (int i = 0; i < 4; ++i) {
+    registers[i] = (unsigned int)values[i];
+  }
+#else
+  __cpuid_count(leaf, subleaf, registers[0], registers[1], registers[2],
+                registers[3]);
+#endif
+}
+
+unsigned long long xgetbv() {
+#ifdef _MSC_VER
+  return _xgetbv(0);
+#else
+  unsigned int eax = 0;
+  unsigned int edx = 0;
+  __asm__ volatile("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+  return ((unsigned long long)edx << 32) | eax;
+#endif
+}
+
+}  // namespace
+#endif
+
+SimdLevel CpuFeatures::simd_level() {
+  static const SimdLevel level = Detect();
+  return level;
+}
+
+SimdLevel CpuFeatures::Detect() {
+#ifdef CPU_FEATURES_X86
+  unsigned int registers[4] = {0, 0, 0, 0};
+
+  cpuid(0, 0, registers);
+  unsigned int max_leaf = registers[0];
+
+  if (max_leaf < 1) {
+    return SimdLevel::Scalar;
+  }
+
+  cpuid(1, 0, registers);
+  bool sse41 = (registers[2] & (1u << 19)) != 0;
+  bool osxsave = (registers[2] & (1u << 27)) != 0;
+  bool avx = (registers[2] & (1u << 28)) != 0;
+
+  if (sse41 == false) {
+    return SimdLevel::Scalar;
+  }
+
+  if (osxsave == false || avx == false || max_leaf < 7) {
+    return SimdLevel::SSE41;
+  }
+
+  // The OS has to save the YMM (and for AVX-512 also the opmask and ZMM)
+  // state on context switches before those registers can be used.
+  unsigned long long xcr0 = xgetbv();
+  bool ymm_state = (xcr0 & 0x06) == 0x06;
+  bool zmm_state = (xcr0 & 0xe6) == 0xe6;
+
+  cpuid(7, 0, registers);
+  bool avx2 = (registers[1] & (1u << 5)) != 0;
+  bool avx512f = (registers[1] & (1u << 16)) != 0;
+  bool avx512bw = (registers[1] & (1u << 30)) != 0;
+
+  if (avx512f == true && avx512bw == true && avx2 == true &&
+      zmm_state == true) {
+    return SimdLevel::AVX512;
+  }
+
+  if (avx2 == true && ymm_state == true) {
+    return SimdLevel::AVX2;
+  }
+
+  return SimdLevel::SSE41;
+#else
+  return SimdLevel::Scalar;
+#endif
+}
@@ -0,0 +1,21 @@
+#ifndef IMAGE__CPU_FEATURES_H_
+#define IMAGE__CPU_FEATURES_H_
+
+enum class SimdLevel : unsigned char {
+  Scalar = 0,
+  SSE41 = 1,
+  AVX2 = 2,
+  AVX512 = 3
+};
+
+class CpuFeatures {
+ public:
+  // Highest instruction set supported by both the CPU and the OS, detected
+  // once with CPUID/XGETBV and cached for the lifetime of the process.
+  static SimdLevel simd_level();
+
+ protected:
+  static SimdLevel Detect();
+};
+
+#endif
@@ -1,187 +1,240 @@
 #include "filter.h"
 
-void Filter::Gaussian(GrayImage& image, GrayImage& filtered_image,
-                       std::size_t size, float sigma) {
-  filtered_image.Reset(image.width(), image.height());
+#include "gradient_kernels.h"
 
-  std::vector<float> filter_buffer = CreateGaussianFilterBuffer(size, sigma);
-  int filter_center = int(roundf(float(size - 1) / 2.0f));
+#if defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define FILTER_USE_SSE2
+#include <emmintrin.h>
+#endif
+
+void Filter::Gaussian(GrayImageView image, GrayImage& filtered_image,
+                       std::size_t size, float sigma) {
+  GaussianScratch scratch;
+  Gaussian(image, filtered_image, size, sigma, scratch);
+}
 
+void Filter::Gaussian(GrayImageView image, GrayImage& filtered_image,
+                       std::size_t size, float sigma,
+                       GaussianScratch& scratch) {
   int image_width = image.width();
   int image_height = image.height();
 
-  auto y_end = image_height - int(size);
-  auto x_end = image_width - int(size);
-
-  auto image_ptr = image.buffer();
-  auto filtered_ptr =
-      filtered_image.buffer() + (image_width * filter_center + filter_center);
+  filtered_image.Resize(image_width, image_height);
 
-  for (auto y = 0; y <= y_end; ++y) {
-    for (auto x = 0; x <= x_end; ++x) {
-      float value = 0.0f;
-
-      for (auto fy = 0; fy < size; ++fy) {
-        std::size_t image_offset = image_width * (y + fy) + x;
-        std::size_t filter_offset = size * fy;
-        for (auto fx = 0; fx < size; ++fx) {
-          value +=
-              image_ptr[image_offset + fx] * filter_buffer[filter_offset + fx];
-        }
-      }
-
-      filtered_ptr[image_width * y + x] =
-          unsigned char(std::min(std::max(int(value), 0), 255));
-    }
-  }
-
-  auto margin_y = image_height - filter_center;
-  auto margin_x = image_width - filter_center;
+  std::vector<float>& kernel = scratch.kernel;
+  CreateGaussianKernel(size, sigma, kernel);
+  int filter_center = int(roundf(float(size - 1) / 2.0f));
+  int filter_size = int(size);
 
-  filtered_ptr = filtered_image.buffer();
+  std::vector<float>& column_sums = scratch.column_sums;
+  std::vector<const unsigned char*>& rows = scratch.rows;
+  column_sums.resize(image_width + filter_size);
+  rows.resize(size);
 
   for (auto y = 0; y < image_height; ++y) {
-    for (auto x = 0; x < image_width; ++x) {
-      if (filter_center <= y && y < margin_y && filter_center <= x &&
-          x < margin_x) {
-        continue;
-      }
-
-      float value = 0.0f;
-      for (int fy = -filter_center, fyy = 0; fy < -filter_center + int(size);
-           ++fy, ++fyy) {
-        for (int fx = -filter_center, fxx = 0; fx < -filter_center + int(size);
-             ++fx, ++fxx) {
-          int image_x = std::min(std::max(x + fx, 0), int(image_width - 1));
-          int image_y = std::min(std::max(y + fy, 0), int(image_height - 1));
-
-          value += image_ptr[(image_width * (image_y)) + image_x] *
-                   filter_buffer[(size * fyy) + fxx];
-        }
-      }
-
-      filtered_ptr[image_width * y + x] =
-          unsigned char(std::min(std::max(int(value), 0), 255));
+    for (auto fy = 0; fy < filter_size; ++fy) {
+      int image_y =
+          std::min(std::max(y - filter_center + fy, 0), image_height - 1);
+      rows[fy] = image.row(image_y);
     }
+
+    GaussianRow(rows.data(), kernel.data(), filter_size, column_sums.data(),
+                filtered_image.row(y), image_width);
   }
 }
 
-void Filter::Sobel(GrayImage& image, IntImage& gx, IntImage& gy,
-                    FloatImage& magnitude) {
+void Filter::Sobel(GrayImageView image, IntImage& gx, IntImage& gy,
+                   FloatImage& magnitude) {
   int image_width = image.width();
   int image_height = image.height();
 
-  gx.Reset(image_width, image_height);
-  gy.Reset(image_width, image_height);
-  magnitude.Reset(image_width, image_height);
+  gx.Resize(image_width, image_height);
+  gy.Resize(image_width, image_height);
+  magnitude.Resize(image_width, image_height);
 
-  int y_end = image_height - 1;
-  int x_end = image_width - 1;
+  gx.ClearMargin(1);
+  gy.ClearMargin(1);
+  magnitude.ClearMargin(1);
 
-  auto gx_ptr = gx.buffer();
-  auto gy_ptr = gy.buffer();
-  auto mag_ptr = magnitude.buffer();
-  auto image_ptr = image.buffer();
+  int y_end = image_height - 1;
 
   for (int y = 1; y < y_end; y++) {
-    int y_offset = image_width * y;
-    for (int x = 1; x < x_end; x++) {
-      int cur_offset = y_offset + x;
+    SobelRow(image.row(y - 1), image.row(y), image.row(y + 1), gx.row(y),
+             gy.row(y), magnitude.row(y), image_width);
+  }
+}
 
-      auto current_image_ptr = image_ptr + cur_offset;
+void Filter::Prewitt(GrayImageView image, IntImage& gx, IntImage& gy,
+                     FloatImage& magnitude) {
+  int image_width = image.width();
+  int image_height = image.height();
 
-      int p00 = current_image_ptr[-image_width - 1];
-      int p01 = current_image_ptr[-image_width];
-      int p02 = current_image_ptr[-image_width + 1];
-      int p10 = current_image_ptr[-1];
-      int p12 = current_image_ptr[1];
-      int p20 = current_image_ptr[image_width - 1];
-      int p21 = current_image_ptr[image_width];
-      int p22 = current_image_ptr[image_width + 1];
+  gx.Resize(image_width, image_height);
+  gy.Resize(image_width, image_height);
+  magnitude.Resize(image_width, image_height);
 
-      int gx = -p00 + p02 + -2 * p10 + 2 * p12 + -p20 + p22;
-      int gy = -p00 - 2 * p01 - p02 + p20 + 2 * p21 + p22;
+  gx.ClearMargin(1);
+  gy.ClearMargin(1);
+  magnitude.ClearMargin(1);
 
-      float magnitude = sqrt(float(gx * gx + gy * gy));
+  int y_end = image_height - 1;
 
-      gx_ptr[cur_offset] = gx;
-      gy_ptr[cur_offset] = gy;
-      mag_ptr[cur_offset] = magnitude;
-    }
+  for (int y = 1; y < y_end; y++) {
+    PrewittRow(image.row(y - 1), image.row(y), image.row(y + 1), gx.row(y),
+               gy.row(y), magnitude.row(y), image_width);
   }
 }
 
-void Filter::Prewitt(GrayImage& image, IntImage& gx, IntImage& gy,
-                      FloatImage& magnitude) {
-  int image_width = image.width();
-  int image_height = image.height();
+void Filter::GaussianRow(const unsigned char* const* rows, const float* kernel,
+                         int size, float* column_sums, unsigned char* filtered,
+                         int width) {
+  int center = int(roundf(float(size - 1) / 2.0f));
 
-  gx.Reset(image_width, image_height);
-  gy.Reset(image_width, image_height);
-  magnitude.Reset(image_width, image_height);
+  // The vertical pass writes the column sums between two margins that
+  // replicate the first and last sums, so the horizontal pass never clamps.
+  float* sums_ptr = column_sums + center;
+  GaussianVerticalPass(rows, kernel, size, sums_ptr, width);
 
-  int y_end = image_height - 1;
-  int x_end = image_width - 1;
+  std::fill(column_sums, sums_ptr, sums_ptr[0]);
+  std::fill(sums_ptr + width, column_sums + width + size,
+            sums_ptr[width - 1]);
 
-  auto gx_ptr = gx.buffer();
-  auto gy_ptr = gy.buffer();
-  auto mag_ptr = magnitude.buffer();
-  auto image_ptr = image.buffer();
+  GaussianHorizontalPass(column_sums, kernel, size, filtered, width);
+}
 
-  for (int y = 1; y < y_end; y++) {
-    int y_offset = image_width * y;
-    for (int x = 1; x < x_end; x++) {
-      int cur_offset = y_offset + x;
+void Filter::SobelRow(const unsigned char* above, const unsigned char* current,
+                      const unsigned char* below, int* gx, int* gy,
+                      float* magnitude, int width) {
+  GradientKernels::Sobel()(above, current, below, gx, gy, magnitude, width);
+}
 
-      auto current_image_ptr = image_ptr + cur_offset;
+void Filter::PrewittRow(const unsigned char* above,
+                        const unsigned char* current,
+                        const unsigned char* below, int* gx, int* gy,
+                        float* magnitude, int width) {
+  GradientKernels::Prewitt()(above, current, below, gx, gy, magnitude, width);
+}
 
-      int p00 = current_image_ptr[-image_width - 1];
-      int p01 = current_image_ptr[-image_width];
-      int p02 = current_image_ptr[-image_width + 1];
-      int p10 = current_image_ptr[-1];
-      int p12 = current_image_ptr[1];
-      int p20 = current_image_ptr[image_width - 1];
-      int p21 = current_image_ptr[image_width];
-      int p22 = current_image_ptr[image_width + 1];
+void Filter::GaussianVerticalPass(const unsigned char* const* rows,
+                                  const float* kernel, int size, float* sums,
+                                  int width) {
+  int x = 0;
+
+#ifdef FILTER_USE_SSE2
+  const __m128i zero = _mm_setzero_si128();
+
+  for (; x + 16 <= width; x += 16) {
+    __m128 sum0 = _mm_setzero_ps();
+    __m128 sum1 = _mm_setzero_ps();
+    __m128 sum2 = _mm_setzero_ps();
+    __m128 sum3 = _mm_setzero_ps();
+
+    for (auto fy = 0; fy < size; ++fy) {
+      __m128 weight = _mm_set1_ps(kernel[fy]);
+      __m128i pixels = _mm_loadu_si128((const __m128i*)(rows[fy] + x));
+      __m128i low = _mm_unpacklo_epi8(pixels, zero);
+      __m128i high = _mm_unpackhi_epi8(pixels, zero);
+
+      __m128 p0 = _mm_cvtepi32_ps(_mm_unpacklo_epi16(low, zero));
+      __m128 p1 = _mm_cvtepi32_ps(_mm_unpackhi_epi16(low, zero));
+      __m128 p2 = _mm_cvtepi32_ps(_mm_unpacklo_epi16(high, zero));
+      __m128 p3 = _mm_cvtepi32_ps(_mm_unpackhi_epi16(high, zero));
+
+      sum0 = _mm_add_ps(sum0, _mm_mul_ps(weight, p0));
+      sum1 = _mm_add_ps(sum1, _mm_mul_ps(weight, p1));
+      sum2 = _mm_add_ps(sum2, _mm_mul_ps(weight, p2));
+      sum3 = _mm_add_ps(sum3, _mm_mul_ps(weight, p3));
+    }
 
-      int gx = -p00 + p02 + -p10 + p12 + -p20 + p22;
-      int gy = -p00 - p01 - p02 + p20 + p21 + p22;
+    _mm_storeu_ps(sums + x, sum0);
+    _mm_storeu_ps(sums + x + 4, sum1);
+    _mm_storeu_ps(sums + x + 8, sum2);
+    _mm_storeu_ps(sums + x + 12, sum3);
+  }
+#endif
 
-      float magnitude = sqrt(float(gx * gx + gy * gy));
+  for (; x < width; ++x) {
+    float value = 0.0f;
+    for (auto fy = 0; fy < size; ++fy) {
+      value += kernel[fy] * rows[fy][x];
+    }
+    sums[x] = value;
+  }
+}
 
-      gx_ptr[cur_offset] = gx;
-      gy_ptr[cur_offset] = gy;
-      mag_ptr[cur_offset] = magnitude;
+void Filter::GaussianHorizontalPass(const float* sums, const float* kernel,
+                                    int size, unsigned char* filtered,
+                                    int width) {
+  int x = 0;
+
+#ifdef FILTER_USE_SSE2
+  for (; x + 16 <= width; x += 16) {
+    __m128 value0 = _mm_setzero_ps();
+    __m128 value1 = _mm_setzero_ps();
+    __m128 value2 = _mm_setzero_ps();
+    __m128 value3 = _mm_setzero_ps();
+
+    for (auto fx = 0; fx < size; ++fx) {
+      __m128 weight = _mm_set1_ps(kernel[fx]);
+      const float* sums_ptr = sums + x + fx;
+
+      __m128 s0 = _mm_loadu_ps(sums_ptr);
+      __m128 s1 = _mm_loadu_ps(sums_ptr + 4);
+      __m128 s2 = _mm_loadu_ps(sums_ptr + 8);
+      __m128 s3 = _mm_loadu_ps(sums_ptr + 12);
+
+      value0 = _mm_add_ps(value0, _mm_mul_ps(weight, s0));
+      value1 = _mm_add_ps(value1, _mm_mul_ps(weight, s1));
+      value2 = _mm_add_ps(value2, _mm_mul_ps(weight, s2));
+      value3 = _mm_add_ps(value3, _mm_mul_ps(weight, s3));
     }
+
+    // Truncate like the scalar path; the saturating packs clamp to [0, 255].
+    __m128i low = _mm_packs_epi32(_mm_cvttps_epi32(value0),
+                                  _mm_cvttps_epi32(value1));
+    __m128i high = _mm_packs_epi32(_mm_cvttps_epi32(value2),
+                                   _mm_cvttps_epi32(value3));
+    _mm_storeu_si128((__m128i*)(filtered + x), _mm_packus_epi16(low, high));
+  }
+#endif
+
+  for (; x < width; ++x) {
+    float value = 0.0f;
+    for (auto fx = 0; fx < size; ++fx) {
+      value += kernel[fx] * sums[x + fx];
+    }
+    filtered[x] = (unsigned char)(std::min(std::max(int(value), 0), 255));
   }
 }
 
-std::vector<float> Filter::CreateGaussianFilterBuffer(std::size_t size,
-                                                       float sigma) {
-  std::vector<float> buffer(size * size);
+std::vector<float> Filter::CreateGaussianKernel(std::size_t size,
+                                                float sigma) {
+  std::vector<float> kernel;
+  CreateGaussianKernel(size, sigma, kernel);
 
-  int center = int(roundf(float(size - 1) / 2.0f));
+  return kernel;
+}
 
-  auto buffer_ptr = buffer.data();
+void Filter::CreateGaussianKernel(std::size_t size, float sigma,
+                                  std::vector<float>& kernel) {
+  kernel.resize(size);
 
-  float sigma_denominator = 2.0f * sigma * sigma;
-  float filter_sum = 0.0f;
+  int center = int(roundf(float(size - 1) / 2.0f));
 
-  for (auto y = 0; y < size; ++y) {
-    auto y_ptr = buffer_ptr + (size * y);
+  float sigma_denominator = 2.0f * sigma * sigma;
+  float kernel_sum = 0.0f;
 
-    for (auto x = 0; x < size; ++x) {
-      float x_term = float((center - x) * (center - x));
-      float y_term = float((center - y) * (center - y));
+  // The 2D Gaussian is the outer product of this kernel with itself, so the
+  // normalized 1D weights reproduce the normalized 2D weights exactly.
+  for (auto x = 0; x < size; ++x) {
+    float x_term = float((center - x) * (center - x));
 
-      y_ptr[x] = exp(-1.0f * float(x_term + y_term) / sigma_denominator);
-      filter_sum += y_ptr[x];
-    }
+    kernel[x] = exp(-1.0f * x_term / sigma_denominator);
+    kernel_sum += kernel[x];
   }
 
-  for (auto& f : buffer) {
-    f /= filter_sum;
+  for (auto& k : kernel) {
+    k /= kernel_sum;
   }
-
-  return buffer;
 }
@@ -5,15 +5,47 @@
 
 class Filter {
  public:
-  static void Gaussian(GrayImage &image, GrayImage &filtered_image,
-                             std::size_t size, float sigma);
-  static void Sobel(GrayImage &image, IntImage &gx, IntImage &gy,
-                    FloatImage &magnitude);
-  static void Prewitt(GrayImage &image, IntImage &gx, IntImage &gy,
+  // Working memory of Gaussian. Callers that filter every frame keep one so
+  // that the filter stops allocating once it has grown to the image width.
+  struct GaussianScratch {
+    std::vector<float> kernel;
+    std::vector<float> column_sums;
+    std::vector<const unsigned char *> rows;
+  };
+
+  static void Gaussian(GrayImageView image, GrayImage &filtered_image,
+                       std::size_t size, float sigma);
+  static void Gaussian(GrayImageView image, GrayImage &filtered_image,
+                       std::size_t size, float sigma, GaussianScratch &scratch);
+  static void Sobel(GrayImageView image, IntImage &gx, IntImage &gy,
                     FloatImage &magnitude);
+  static void Prewitt(GrayImageView image, IntImage &gx, IntImage &gy,
+                      FloatImage &magnitude);
 
- protected:
-  static std::vector<float> CreateGaussianFilterBuffer(std::size_t size, float sigma);
+ public:
+  // Single-row kernels shared by the whole-image filters above and by fused
+  // passes that stream rows through several stages while they stay in cache.
+  // column_sums needs room for width + size floats.
+  static void GaussianRow(const unsigned char* const* rows, const float* kernel,
+                          int size, float* column_sums, unsigned char* filtered,
+                          int width);
+  static void SobelRow(const unsigned char* above, const unsigned char* current,
+                       const unsigned char* below, int* gx, int* gy,
+                       float* magnitude, int width);
+  static void PrewittRow(const unsigned char* above,
+                         const unsigned char* current,
+                         const unsigned char* below, int* gx, int* gy,
+                         float* magnitude, int width);
+  static std::vector<float> CreateGaussianKernel(std::size_t size, float sigma);
+  static void CreateGaussianKernel(std::size_t size, float sigma,
+                                   std::vector<float> &kernel);
 
+ protected:
+  static void GaussianVerticalPass(const unsigned char* const* rows,
+                                   const float* kernel, int size, float* sums,
+                                   int width);
+  static void GaussianHorizontalPass(const float* sums, const float* kernel,
+                                     int size, unsigned char* filtered,
+                                     int width);
 };
 #endif
\ No newline at end of file
@@ -0,0 +1,286 @@
+#include "gradient_kernels.h"
+
+#include <cmath>
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || \
+    defined(_M_IX86)
+#define GRADIENT_KERNELS_X86
+#include <immintrin.h>
+#endif
+
+#if defined(_MSC_VER) && !defined(__clang__)
+#define GRADIENT_KERNELS_TARGET(isa)
+#else
+#define GRADIENT_KERNELS_TARGET(isa) __attribute__((target(isa)))
+#endif
+
+// Sobel and Prewitt only differ in the weight of the centre row/column:
+//   gx = (p02 - p00) + w * (p12 - p10) + (p22 - p20)
+//   gy = (p20 - p00) + w * (p21 - p01) + (p22 - p02)
+// The vector kernels evaluate this in 16-bit lanes, which is exact for 8-bit
+// input, widen gx/gy to 32 bits and take the square root of the exact
+// integer gx * gx + gy * gy, so they match the scalar kernel bit for bit.
+
+namespace {
+
+template <int Weight>
+void GradientRowScalar(const unsigned char* above, const unsigned char* current,
+                       const unsigned char* below, int* gx, int* gy,
+                       float* magnitude, int begin, int end) {
+  for (int x = begin; x < end; x++) {
+    int p00 = above[x - 1];
+    int p01 = above[x];
+    int p02 = above[x + 1];
+    int p10 = current[x - 1];
+    int p12 = current[x + 1];
+    int p20 = below[x - 1];
+    int p21 = below[x];
+    int p22 = below[x + 1];
+
+    int gradient_x = (p02 - p00) + Weight * (p12 - p10) + (p22 - p20);
+    int gradient_y = (p20 - p00) + Weight * (p21 - p01) + (p22 - p02);
+
+    gx[x] = gradient_x;
+    gy[x] = gradient_y;
+    magnitude[x] =
+        std::sqrt(float(gradient_x * gradient_x + gradient_y * gradient_y));
+  }
+}
+
+template <int Weight>
+void GradientRow(const unsigned char* above, const unsigned char* current,
+                 const unsigned char* below, int* gx, int* gy,
+                 float* magnitude, int width) {
+  GradientRowScalar<Weight>(above, current, below, gx, gy, magnitude, 1,
+                            width - 1);
+}
+
+#ifdef GRADIENT_KERNELS_X86
+
+GRADIENT_KERNELS_TARGET("sse4.1")
+inline __m128i LoadPixels8(const unsigned char* pixels) {
+  return _mm_cvtepu8_epi16(_mm_loadl_epi64((const __m128i*)pixels));
+}
+
+GRADIENT_KERNELS_TARGET("avx2")
+inline __m256i LoadPixels16(const unsigned char* pixels) {
+  return _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)pixels));
+}
+
+GRADIENT_KERNELS_TARGET("avx2,avx512f,avx512bw")
+inline __m512i LoadPixels32(const unsigned char* pixels) {
+  return _mm512_cvtepu8_epi16(_mm256_loadu_si256((const __m256i*)pixels));
+}
+
+template <int Weight>
+GRADIENT_KERNELS_TARGET("sse4.1")
+void GradientRowSSE41(const unsigned char* above, const unsigned char* current,
+                      const unsigned char* below, int* gx, int* gy,
+                      float* magnitude, int width) {
+  const int kStep = 8;
+  int x = 1;
+
+  for (; x + kStep < width; x += kStep) {
+    __m128i p00 = LoadPixels8(above + x - 1);
+    __m128i p01 = LoadPixels8(above + x);
+    __m128i p02 = LoadPixels8(above + x + 1);
+    __m128i p10 = LoadPixels8(current + x - 1);
+    __m128i p12 = LoadPixels8(current + x + 1);
+    __m128i p20 = LoadPixels8(below + x - 1);
+    __m128i p21 = LoadPixels8(below + x);
+    __m128i p22 = LoadPixels8(below + x + 1);
+
+    __m128i center_x = _mm_sub_epi16(p12, p10);
+    __m128i center_y = _mm_sub_epi16(p21, p01);
+    if (Weight == 2) {
+      center_x = _mm_add_epi16(center_x, center_x);
+      center_y = _mm_add_epi16(center_y, center_y);
+    }
+
+    __m128i gradient_x =
+        _mm_add_epi16(_mm_add_epi16(_mm_sub_epi16(p02, p00), center_x),
+                      _mm_sub_epi16(p22, p20));
+    __m128i gradient_y =
+        _mm_add_epi16(_mm_add_epi16(_mm_sub_epi16(p20, p00), center_y),
+                      _mm_sub_epi16(p22, p02));
+
+    _mm_storeu_si128((__m128i*)(gx + x), _mm_cvtepi16_epi32(gradient_x));
+    _mm_storeu_si128((__m128i*)(gx + x + 4),
+                     _mm_cvtepi16_epi32(_mm_srli_si128(gradient_x, 8)));
+    _mm_storeu_si128((__m128i*)(gy + x), _mm_cvtepi16_epi32(gradient_y));
+    _mm_storeu_si128((__m128i*)(gy + x + 4),
+                     _mm_cvtepi16_epi32(_mm_srli_si128(gradient_y, 8)));
+
+    // madd over interleaved (gx, gy) pairs yields gx * gx + gy * gy.
+    __m128i pairs_low = _mm_unpacklo_epi16(gradient_x, gradient_y);
+    __m128i pairs_high = _mm_unpackhi_epi16(gradient_x, gradient_y);
+    __m128i squared_low = _mm_madd_epi16(pairs_low, pairs_low);
+    __m128i squared_high = _mm_madd_epi16(pairs_high, pairs_high);
+
+    _mm_storeu_ps(magnitude + x, _mm_sqrt_ps(_mm_cvtepi32_ps(squared_low)));
+    _mm_storeu_ps(magnitude + x + 4,
+                  _mm_sqrt_ps(_mm_cvtepi32_ps(squared_high)));
+  }
+
+  GradientRowScalar<Weight>(above, current, below, gx, gy, magnitude, x,
+                            width - 1);
+}
+
+template <int Weight>
+GRADIENT_KERNELS_TARGET("avx2")
+void GradientRowAVX2(const unsigned char* above, const unsigned char* current,
+                     const unsigned char* below, int* gx, int* gy,
+                     float* magnitude, int width) {
+  const int kStep = 16;
+  int x = 1;
+
+  for (; x + kStep < width; x += kStep) {
+    __m256i p00 = LoadPixels16(above + x - 1);
+    __m256i p01 = LoadPixels16(above + x);
+    __m256i p02 = LoadPixels16(above + x + 1);
+    __m256i p10 = LoadPixels16(current + x - 1);
+    __m256i p12 = LoadPixels16(current + x + 1);
+    __m256i p20 = LoadPixels16(below + x - 1);
+    __m256i p21 = LoadPixels16(below + x);
+    __m256i p22 = LoadPixels16(below + x + 1);
+
+    __m256i center_x = _mm256_sub_epi16(p12, p10);
+    __m256i center_y = _mm256_sub_epi16(p21, p01);
+    if (Weight == 2) {
+      center_x = _mm256_add_epi16(center_x, center_x);
+      center_y = _mm256_add_epi16(center_y, center_y);
+    }
+
+    __m256i gradient_x = _mm256_add_epi16(
+        _mm256_add_epi16(_mm256_sub_epi16(p02, p00), center_x),
+        _mm256_sub_epi16(p22, p20));
+    __m256i gradient_y = _mm256_add_epi16(
+        _mm256_add_epi16(_mm256_sub_epi16(p20, p00), center_y),
+        _mm256_sub_epi16(p22, p02));
+
+    __m256i gx_low = _mm256_cvtepi16_epi32(_mm256_castsi256_si128(gradient_x));
+    __m256i gx_high =
+        _mm256_cvtepi16_epi32(_mm256_extracti128_si256(gradient_x, 1));
+    __m256i gy_low = _mm256_cvtepi16_epi32(_mm256_castsi256_si128(gradient_y));
+    __m256i gy_high =
+        _mm256_cvtepi16_epi32(_mm256_extracti128_si256(gradient_y, 1));
+
+    _mm256_storeu_si256((__m256i*)(gx + x), gx_low);
+    _mm256_storeu_si256((__m256i*)(gx + x + 8), gx_high);
+    _mm256_storeu_si256((__m256i*)(gy + x), gy_low);
+    _mm256_storeu_si256((__m256i*)(gy + x + 8), gy_high);
+
+    __m256i squared_low = _mm256_add_epi32(_mm256_mullo_epi32(gx_low, gx_low),
+                                           _mm256_mullo_epi32(gy_low, gy_low));
+    __m256i squared_high =
+        _mm256_add_epi32(_mm256_mullo_epi32(gx_high, gx_high),
+                         _mm256_mullo_epi32(gy_high, gy_high));
+
+    _mm256_storeu_ps(magnitude + x,
+                     _mm256_sqrt_ps(_mm256_cvtepi32_ps(squared_low)));
+    _mm256_storeu_ps(magnitude + x + 8,
+                     _mm256_sqrt_ps(_mm256_cvtepi32_ps(squared_high)));
+  }
+
+  GradientRowScalar<Weight>(above, current, below, gx, gy, magnitude, x,
+                            width - 1);
+}
+
+template <int Weight>
+GRADIENT_KERNELS_TARGET("avx2,avx512f,avx512bw")
+void GradientRowAVX512(const unsigned char* above, const unsigned char* current,
+                       const unsigned char* below, int* gx, int* gy,
+                       float* magnitude, int width) {
+  const int kStep = 32;
+  int x = 1;
+
+  for (; x + kStep < width; x += kStep) {
+    __m512i p00 = LoadPixels32(above + x - 1);
+    __m512i p01 = LoadPixels32(above + x);
+    __m512i p02 = LoadPixels32(above + x + 1);
+    __m512i p10 = LoadPixels32(current + x - 1);
+    __m512i p12 = LoadPixels32(current + x + 1);
+    __m512i p20 = LoadPixels32(below + x - 1);
+    __m512i p21 = LoadPixels32(below + x);
+    __m512i p22 = LoadPixels32(below + x + 1);
+
+    __m512i center_x = _mm512_sub_epi16(p12, p10);
+    __m512i center_y = _mm512_sub_epi16(p21, p01);
+    if (Weight == 2) {
+      center_x = _mm512_add_epi16(center_x, center_x);
+      center_y = _mm512_add_epi16(center_y, center_y);
+    }
+
+    __m512i gradient_x = _mm512_add_epi16(
+        _mm512_add_epi16(_mm512_sub_epi16(p02, p00), center_x),
+        _mm512_sub_epi16(p22, p20));
+    __m512i gradient_y = _mm512_add_epi16(
+        _mm512_add_epi16(_mm512_sub_epi16(p20, p00), center_y),
+        _mm512_sub_epi16(p22, p02));
+
+    __m512i gx_low = _mm512_cvtepi16_epi32(_mm512_castsi512_si256(gradient_x));
+    __m512i gx_high =
+        _mm512_cvtepi16_epi32(_mm512_extracti64x4_epi64(gradient_x, 1));
+    __m512i gy_low = _mm512_cvtepi16_epi32(_mm512_castsi512_si256(gradient_y));
+    __m512i gy_high =
+        _mm512_cvtepi16_epi32(_mm512_extracti64x4_epi64(gradient_y, 1));
+
+    _mm512_storeu_si512((void*)(gx + x), gx_low);
+    _mm512_storeu_si512((void*)(gx + x + 16), gx_high);
+    _mm512_storeu_si512((void*)(gy + x), gy_low);
+    _mm512_storeu_si512((void*)(gy + x + 16), gy_high);
+
+    __m512i squared_low = _mm512_add_epi32(_mm512_mullo_epi32(gx_low, gx_low),
+                                           _mm512_mullo_epi32(gy_low, gy_low));
+    __m512i squared_high =
+        _mm512_add_epi32(_mm512_mullo_epi32(gx_high, gx_high),
+                         _mm512_mullo_epi32(gy_high, gy_high));
+
+    _mm512_storeu_ps(magnitude + x,
+                     _mm512_sqrt_ps(_mm512_cvtepi32_ps(squared_low)));
+    _mm512_storeu_ps(magnitude + x + 16,
+                     _mm512_sqrt_ps(_mm512_cvtepi32_ps(squared_high)));
+  }
+
+  GradientRowScalar<Weight>(above, current, below, gx, gy, magnitude, x,
+                            width - 1);
+}
+
+#endif
+
+template <int Weight>
+GradientRowKernel SelectKernel(SimdLevel level) {
+#ifdef GRADIENT_KERNELS_X86
+  switch (level) {
+    case SimdLevel::AVX512:
+      return GradientRowAVX512<Weight>;
+    case SimdLevel::AVX2:
+      return GradientRowAVX2<Weight>;
+    case SimdLevel::SSE41:
+      return GradientRowSSE41<Weight>;
+    default:
+      break;
+  }
+#endif
+  return GradientRow<Weight>;
+}
+
+}  // namespace
+
+GradientRowKernel GradientKernels::Sobel() {
+  static const GradientRowKernel kernel = Sobel(CpuFeatures::simd_level());
+  return kernel;
+}
+
+GradientRowKernel GradientKernels::Prewitt() {
+  static const GradientRowKernel kernel = Prewitt(CpuFeatures::simd_level());
+  return kernel;
+}
+
+GradientRowKernel GradientKernels::Sobel(SimdLevel level) {
+  return SelectKernel<2>(level);
+}
+
+GradientRowKernel GradientKernels::Prewitt(SimdLevel level) {
+  return SelectKernel<1>(level);
+}
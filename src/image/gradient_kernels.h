@@ -0,0 +1,25 @@
+#ifndef IMAGE__GRADIENT_KERNELS_H_
+#define IMAGE__GRADIENT_KERNELS_H_
+
+#include "cpu_features.h"
+
+// Computes gx, gy and magnitude for x in [1, width - 1) of one image row from
+// the rows directly above and below it.
+using GradientRowKernel = void (*)(const unsigned char* above,
+                                   const unsigned char* current,
+                                   const unsigned char* below, int* gx,
+                                   int* gy, float* magnitude, int width);
+
+class GradientKernels {
+ public:
+  // Kernels for the best instruction set of the running CPU.
+  static GradientRowKernel Sobel();
+  static GradientRowKernel Prewitt();
+
+  // Kernels for an explicit instruction set, falling back to the next lower
+  // one that was compiled in.
+  static GradientRowKernel Sobel(SimdLevel level);
+  static GradientRowKernel Prewitt(SimdLevel level);
+};
+
+#endif
@@ -1,27 +1,63 @@
 #ifndef IMAGE__IMAGE_H_
 #define IMAGE__IMAGE_H_
 
+#include <algorithm>
 #include <memory>
 #include <opencv2/core.hpp>
 
+#include "image_memory.h"
+
+// Owning image plane. Rows are kAlignment-byte aligned and separated by
+// stride() elements; the stride only depends on the width and the border, so
+// planes of different pixel types with the same geometry share offsets. The
+// pixels are surrounded by a zero-filled guard border of at least border()
+// pixels on every side, which lets 3x3 kernels and the edge linker read one
+// pixel past the image without bounds checks. The left border is widened to
+// a whole kAlignment block so that row(y) itself is aligned.
 template <typename T>
 class Image {
  public:
   Image(std::size_t width, std::size_t height);
   Image(std::size_t width, std::size_t height, const T* buffer);
+  Image(const Image& other);
+  Image(Image&& other);
   Image() = delete;
+  ~Image();
+
+  Image& operator=(Image other);
 
  public:
   void Reset(std::size_t width, std::size_t height);
- 
+  void Reset(std::size_t width, std::size_t height, std::size_t border);
+  void Resize(std::size_t width, std::size_t height);
+  void ClearMargin(std::size_t margin);
+
   std::size_t width();
   std::size_t height();
+  std::size_t stride();
+  std::size_t border();
   T* buffer();
+  T* row(std::size_t y);
 
  protected:
-  std::size_t width_;
-  std::size_t height_;
-  std::vector<T> buffer_;
+  void swap(Image& other);
+
+  static std::size_t LeftPadding(std::size_t border);
+  static std::size_t Stride(std::size_t width, std::size_t border);
+
+ protected:
+  static const std::size_t kAlignment = ImageMemory::kAlignment;
+  static_assert(kAlignment % sizeof(T) == 0,
+                "pixels must tile an alignment block");
+
+  std::size_t width_ = 0;
+  std::size_t height_ = 0;
+  std::size_t stride_ = 0;
+  std::size_t border_ = 0;
+
+  T* memory_ = nullptr;
+  std::size_t memory_size_ = 0;
+  bool huge_page_ = false;
 };
 
 template <typename T>
@@ -30,26 +66,99 @@ Image<T>::Image(std::size_t width, std::size_t height)
 
 template <typename T>
 Image<T>::Image(std::size_t width, std::size_t height, const T* buffer) {
-  width_ = width;
-  height_ = height;
+  Reset(width, height, 0);
 
-  if (buffer == nullptr) {
-    buffer_.resize(width * height);
-  } else {
-    buffer_.insert(buffer_.end(), buffer, buffer + (width_ * height_));
+  if (buffer != nullptr) {
+    for (std::size_t y = 0; y < height_; ++y) {
+      std::copy(buffer + (width_ * y), buffer + (width_ * (y + 1)), row(y));
+    }
   }
 }
 
+template <typename T>
+Image<T>::Image(const Image& other) {
+  memory_ = (T*)ImageMemory::Allocate(other.memory_size_, huge_page_);
+  memory_size_ = other.memory_size_;
+  std::copy(other.memory_, other.memory_ + (memory_size_ / sizeof(T)),
+            memory_);
+
+  width_ = other.width_;
+  height_ = other.height_;
+  stride_ = other.stride_;
+  border_ = other.border_;
+}
+
+template <typename T>
+Image<T>::Image(Image&& other) {
+  swap(other);
+}
+
+template <typename T>
+Image<T>::~Image() {
+  ImageMemory::Free(memory_, memory_size_, huge_page_);
+}
+
+template <typename T>
+Image<T>& Image<T>::operator=(Image other) {
+  swap(other);
+  return *this;
+}
+
 template <typename T>
 void Image<T>::Reset(std::size_t width, std::size_t height) {
-  if (width_ * height_ != width * height) {
-    buffer_.resize(width * height);
+  Reset(width, height, border_);
+}
+
+template <typename T>
+void Image<T>::Reset(std::size_t width, std::size_t height,
+                     std::size_t border) {
+  std::size_t stride = Stride(width, border);
+  std::size_t bytes = stride * (height + 2 * border) * sizeof(T);
+
+  if (bytes > memory_size_) {
+    ImageMemory::Free(memory_, memory_size_, huge_page_);
+    memory_ = nullptr;
+    memory_size_ = 0;
+
+    memory_ = (T*)ImageMemory::Allocate(bytes, huge_page_);
+    memory_size_ = bytes;
   }
 
-  std::fill(buffer_.begin(), buffer_.end(), 0);
+  std::fill(memory_, memory_ + (bytes / sizeof(T)), T(0));
 
   width_ = width;
   height_ = height;
+  stride_ = stride;
+  border_ = border;
+}
+
+// Like Reset, but keeps the current pixels when the geometry is unchanged.
+// Planes that are fully rewritten every frame use this to skip the fill.
+template <typename T>
+void Image<T>::Resize(std::size_t width, std::size_t height) {
+  if (width == width_ && height == height_ && memory_ != nullptr) {
+    return;
+  }
+
+  Reset(width, height, border_);
+}
+
+// Zeroes the outermost margin rows and columns of the image itself, the
+// part 3x3 operators leave untouched.
+template <typename T>
+void Image<T>::ClearMargin(std::size_t margin) {
+  margin = std::min(margin, std::min(width_, height_));
+
+  for (std::size_t y = 0; y < height_; ++y) {
+    T* row_ptr = row(y);
+
+    if (y < margin || y >= height_ - margin) {
+      std::fill(row_ptr, row_ptr + width_, T(0));
+    } else {
+      std::fill(row_ptr, row_ptr + margin, T(0));
+      std::fill(row_ptr + width_ - margin, row_ptr + width_, T(0));
+    }
+  }
 }
 
 template <typename T>
@@ -62,13 +171,120 @@ std::size_t Image<T>::height() {
   return height_;
 }
 
+template <typename T>
+std::size_t Image<T>::stride() {
+  return stride_;
+}
+
+template <typename T>
+std::size_t Image<T>::border() {
+  return border_;
+}
+
 template <typename T>
 T* Image<T>::buffer() {
-  return buffer_.data();
+  return memory_ + (stride_ * border_ + LeftPadding(border_));
+}
+
+template <typename T>
+T* Image<T>::row(std::size_t y) {
+  return buffer() + (stride() * y);
+}
+
+// The guard border in front of every row, rounded up to whole kAlignment
+// blocks of this pixel type.
+template <typename T>
+std::size_t Image<T>::LeftPadding(std::size_t border) {
+  const std::size_t kBlock = kAlignment / sizeof(T);
+  return (border + kBlock - 1) / kBlock * kBlock;
+}
+
+// Rows are padded to a multiple of kAlignment elements, not bytes: that is
+// what aligns the rows of one-byte planes, and it keeps the stride the same
+// for every pixel type so that planes share offsets. The room reserved in
+// front of the pixels is the widest left padding, that of one-byte pixels.
+template <typename T>
+std::size_t Image<T>::Stride(std::size_t width, std::size_t border) {
+  std::size_t widest_padding = (border + kAlignment - 1) / kAlignment *
+                               kAlignment;
+  return (widest_padding + width + border + kAlignment - 1) / kAlignment *
+         kAlignment;
+}
+
+template <typename T>
+void Image<T>::swap(Image& other) {
+  std::swap(width_, other.width_);
+  std::swap(height_, other.height_);
+  std::swap(stride_, other.stride_);
+  std::swap(border_, other.border_);
+  std::swap(memory_, other.memory_);
+  std::swap(memory_size_, other.memory_size_);
+  std::swap(huge_page_, other.huge_page_);
+}
+
+// Non-owning window onto pixels that live elsewhere: an Image, a cv::Mat or
+// ROI, or a capture/decode buffer. stride is the distance between rows in
+// elements and may be larger than width.
+template <typename T>
+class ImageView {
+ public:
+  ImageView(T* buffer, std::size_t width, std::size_t height,
+            std::size_t stride);
+  ImageView(Image<T>& image);
+
+ public:
+  std::size_t width() const;
+  std::size_t height() const;
+  std::size_t stride() const;
+  T* buffer() const;
+  T* row(std::size_t y) const;
+
+ protected:
+  T* buffer_;
+  std::size_t width_;
+  std::size_t height_;
+  std::size_t stride_;
+};
+
+template <typename T>
+ImageView<T>::ImageView(T* buffer, std::size_t width, std::size_t height,
+                        std::size_t stride)
+    : buffer_(buffer), width_(width), height_(height), stride_(stride) {}
+
+template <typename T>
+ImageView<T>::ImageView(Image<T>& image)
+    : ImageView(image.buffer(), image.width(), image.height(),
+                image.stride()) {}
+
+template <typename T>
+std::size_t ImageView<T>::width() const {
+  return width_;
+}
+
+template <typename T>
+std::size_t ImageView<T>::height() const {
+  return height_;
+}
+
+template <typename T>
+std::size_t ImageView<T>::stride() const {
+  return stride_;
+}
+
+template <typename T>
+T* ImageView<T>::buffer() const {
+  return buffer_;
+}
+
+template <typename T>
+T* ImageView<T>::row(std::size_t y) const {
+  return buffer_ + (stride_ * y);
 }
 
 using GrayImage = Image<unsigned char>;
 using IntImage = Image<int>;
 using FloatImage = Image<float>;
 
+using GrayImageView = ImageView<unsigned char>;
+
 #endif
\ No newline at end of file
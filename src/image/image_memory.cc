@@ -0,0 +1,115 @@
+#include "image_memory.h"
+
+#include <cstdlib>
+#include <new>
+
+#if defined(_WIN32)
+#include <malloc.h>
+#include <windows.h>
+#elif defined(__linux__)
+#include <sys/mman.h>
+#endif
+
+bool ImageMemory::huge_pages_ = false;
+
+namespace {
+
+std::size_t RoundUp(std::size_t value, std::size_t alignment) {
+  return (value + alignment - 1) / alignment * alignment;
+}
+
+void* AlignedAllocate(std::size_t bytes, std::size_t alignment) {
+#if defined(_WIN32)
+  return _aligned_malloc(bytes, alignment);
+#else
+  void* memory = nullptr;
+  if (posix_memalign(&memory, alignment, bytes) != 0) {
+    return nullptr;
+  }
+  return memory;
+#endif
+}
+
+void AlignedFree(void* memory) {
+#if defined(_WIN32)
+  _aligned_free(memory);
+#else
+  free(memory);
+#endif
+}
+
+}  // namespace
+
+void ImageMemory::set_huge_pages(bool enabled) { huge_pages_ = enabled; }
+
+bool ImageMemory::huge_pages() { return huge_pages_; }
+
+void* ImageMemory::Allocate(std::size_t bytes, bool& huge_page) {
+  huge_page = false;
+
+  if (bytes == 0) {
+    return nullptr;
+  }
+
+  std::size_t alignment = kAlignment;
+
+  if (huge_pages_ == true && bytes >= kHugePageSize) {
+#if defined(_WIN32)
+    // Large pages need the SeLockMemoryPrivilege; without it VirtualAlloc
+    // fails and the block falls back to regular pages.
+    std::size_t large_page_size = GetLargePageMinimum();
+    if (large_page_size > 0) {
+      void* memory = VirtualAlloc(
+          nullptr, RoundUp(bytes, large_page_size),
+          MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+      if (memory != nullptr) {
+        huge_page = true;
+        return memory;
+      }
+    }
+#elif defined(__linux__)
+#ifdef MAP_HUGETLB
+    void* memory = mmap(nullptr, RoundUp(bytes, kHugePageSize),
+                        PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (memory != MAP_FAILED) {
+      huge_page = true;
+      return memory;
+    }
+#endif
+    // No reserved huge pages: ask for transparent huge pages instead.
+    alignment = kHugePageSize;
+    bytes = RoundUp(bytes, kHugePageSize);
+#endif
+  }
+
+  void* memory = AlignedAllocate(bytes, alignment);
+  if (memory == nullptr) {
+    throw std::bad_alloc();
+  }
+
+#if defined(__linux__) && defined(MADV_HUGEPAGE)
+  if (alignment == kHugePageSize) {
+    madvise(memory, bytes, MADV_HUGEPAGE);
+  }
+#endif
+
+  return memory;
+}
+
+void ImageMemory::Free(void* memory, std::size_t bytes, bool huge_page) {
+  if (memory == nullptr) {
+    return;
+  }
+
+  if (huge_page == true) {
+#if defined(_WIN32)
+    VirtualFree(memory, 0, MEM_RELEASE);
+#elif defined(__linux__)
+    munmap(memory, RoundUp(bytes, kHugePageSize));
+#endif
+    return;
+  }
+
+  AlignedFree(memory);
+}
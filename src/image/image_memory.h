@@ -0,0 +1,27 @@
+#ifndef IMAGE__IMAGE_MEMORY_H_
+#define IMAGE__IMAGE_MEMORY_H_
+
+#include <cstddef>
+
+// Allocation policy for image planes. Blocks are aligned to kAlignment bytes
+// so that every row of an Image starts on a cache line. When huge pages are
+// enabled, blocks of at least kHugePageSize bytes are backed by 2 MB pages
+// where the OS allows it, which cuts TLB misses on 4K frames.
+class ImageMemory {
+ public:
+  static const std::size_t kAlignment = 64;
+  static const std::size_t kHugePageSize = 2 * 1024 * 1024;
+
+  static void set_huge_pages(bool enabled);
+  static bool huge_pages();
+
+  // huge_page reports whether the block has to be released as a huge page
+  // mapping; it must be handed back to Free unchanged.
+  static void* Allocate(std::size_t bytes, bool& huge_page);
+  static void Free(void* memory, std::size_t bytes, bool huge_page);
+
+ protected:
+  static bool huge_pages_;
+};
+
+#endif
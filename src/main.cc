@@ -1,4 +1,6 @@
+#include <algorithm>
 #include <chrono>
+#include <cstdlib>
 #include <iostream>
 #include <opencv2/highgui.hpp>
 #include <opencv2/imgproc.hpp>
@@ -17,13 +19,23 @@ struct Config {
   std::string filename;
   bool video_mode;
   bool verbose;
+  bool compact;
+  bool orientation;
+  int thread_count;
   bool error;
 };
 
+struct Workspace {
+ public:
+  EDCircle ed_circle;
+  cv::Mat gray_image;
+  cv::Mat frame;
+};
+
 void print_help();
 void print_invalid_input_file(std::string filename);
 Config parse_args(int argc, char *argv[]);
-void DetectCircle(cv::Mat &cv_image, bool verbose);
+void DetectCircle(cv::Mat &cv_image, Workspace &workspace, bool verbose);
 
 int main(int argc, char *argv[]) {
   Config config = parse_args(argc, argv);
@@ -32,6 +44,13 @@ int main(int argc, char *argv[]) {
     return -1;
   }
 
+  Workspace workspace;
+  workspace.ed_circle.set_verbose(config.verbose);
+  workspace.ed_circle.set_gaussian_smoothing(5, 1.0f);
+  workspace.ed_circle.set_compact_gradient(config.compact);
+  workspace.ed_circle.set_thread_count(config.thread_count);
+  workspace.ed_circle.set_orientation_map(config.orientation);
+
   if (config.video_mode == true) {
     cv::VideoCapture video;
     bool is_opened = video.open(config.filename);
@@ -44,13 +63,13 @@ int main(int argc, char *argv[]) {
     std::cout << "Press 'q' to exit." << std::endl;
 
     while (true) {
-      cv::Mat frame;
+      cv::Mat &frame = workspace.frame;
       video.read(frame);
       if (frame.empty() == true) {
         break;
       }
 
-      DetectCircle(frame, config.verbose);
+      DetectCircle(frame, workspace, config.verbose);
 
       char pressed_key = cv::waitKey(1);
       if (pressed_key == 'q') {
@@ -64,15 +83,22 @@ int main(int argc, char *argv[]) {
       return -1;
     }
 
-    DetectCircle(image, config.verbose);
+    DetectCircle(image, workspace, config.verbose);
 
     cv::waitKey(0);
   }
 }
 
 void print_help() {
-  std::cout << "Usage: EDCircle [-m|-i] [video filename|image filename]"
+  std::cout << "Usage: EDCircle [-m|-i] [video filename|image filename] [-v] "
+               "[-c] [-o] [-t threads]"
+            << std::endl;
+  std::cout << "  -v  print stage timings and show intermediate results"
+            << std::endl;
+  std::cout << "  -c  keep gradients in compact 16-bit planes" << std::endl;
+  std::cout << "  -o  validate with the quantized orientation map"
             << std::endl;
+  std::cout << "  -t  number of threads used to link edges" << std::endl;
 }
 
 void print_invalid_input_file(std::string filename) {
@@ -81,7 +107,7 @@ void print_invalid_input_file(std::string filename) {
 
 Config parse_args(int argc, char *argv[]) {
   if (argc < 3) {
-    Config config{"", false, true};
+    Config config{"", false, false, false, false, 1, true};
     return config;
   }
 
@@ -89,6 +115,9 @@ Config parse_args(int argc, char *argv[]) {
   std::string filename;
   bool error = false;
   bool verbose = false;
+  bool compact = false;
+  bool orientation = false;
+  int thread_count = 1;
 
   for (int i = 1; i < argc; i++) {
     if (std::string("-m").compare(argv[i]) == 0) {
@@ -105,6 +134,17 @@ Config parse_args(int argc, char *argv[]) {
       }
     } else if (std::string("-v").compare(argv[i]) == 0) {
       verbose = true;
+    } else if (std::string("-c").compare(argv[i]) == 0) {
+      compact = true;
+    } else if (std::string("-o").compare(argv[i]) == 0) {
+      orientation = true;
+    } else if (std::string("-t").compare(argv[i]) == 0) {
+      if (i + 1 < argc) {
+        thread_count = std::max(1, atoi(argv[i + 1]));
+        i++;
+      } else {
+        error = true;
+      }
     } else {
       error = true;
     }
@@ -115,29 +155,26 @@ Config parse_args(int argc, char *argv[]) {
   }
 
   if (error == true) {
-    return Config{"", false, false, true};
+    return Config{"", false, false, false, false, 1, true};
   } else {
-    return Config{filename, video_mode, verbose, false};
+    return Config{filename, video_mode, verbose,      compact,
+                  orientation, thread_count, false};
   }
 }
 
-void DetectCircle(cv::Mat &cv_image, bool verbose) {
+void DetectCircle(cv::Mat &cv_image, Workspace &workspace, bool verbose) {
   cv::Mat cv_gray_image;
   if (cv_image.type() == CV_8UC3) {
-    cv::cvtColor(cv_image, cv_gray_image, cv::COLOR_BGR2GRAY);
+    cv::cvtColor(cv_image, workspace.gray_image, cv::COLOR_BGR2GRAY);
+    cv_gray_image = workspace.gray_image;
   } else {
     cv_gray_image = cv_image;
   }
 
-  GrayImage image = Util::FromMat(cv_gray_image);
-  GrayImage gaussian_filtered(image.width(), image.height());
-  STOPWATCHSTART(verbose)
-  Filter::Gaussian(image, gaussian_filtered, 5, 1.0);
-  STOPWATCHSTOP(verbose, "Filter::Gaussian - ")
+  GrayImageView image = Util::ViewOf(cv_gray_image);
 
-  EDCircle ed_circle;
-  ed_circle.set_verbose(verbose);
-  ed_circle.DetectCircle(gaussian_filtered);
+  EDCircle &ed_circle = workspace.ed_circle;
+  ed_circle.DetectCircle(image);
 
   if (verbose == true) {
     cv::Mat edge_image = cv::Mat::zeros(cv_image.size(), CV_8UC1);
@@ -145,24 +182,19 @@ void DetectCircle(cv::Mat &cv_image, bool verbose) {
     cv::Mat arcs_image = cv_image.clone();
     cv::Mat extended_arcs_image = cv_image.clone();
 
-    auto edge_segments = ed_circle.edge_segments();
-    auto lines = ed_circle.lines();
-    auto arcs = ed_circle.arcs();
-    auto extended_arcs = ed_circle.arcs();
-
-    for (auto edge_segment : edge_segments) {
+    for (const auto &edge_segment : ed_circle.edge_segments()) {
       edge_segment.Draw(edge_image, cv::Scalar(255, 255, 255));
     }
 
-    for (auto line : lines) {
+    for (const auto &line : ed_circle.lines()) {
       line.Draw(lines_image, cv::Scalar(255, 255, 0));
     }
 
-    for (auto arc : arcs) {
+    for (const auto &arc : ed_circle.arcs()) {
       arc.Draw(arcs_image, cv::Scalar(255, 255, 0));
     }
 
-    for (auto extended_arc : extended_arcs) {
+    for (const auto &extended_arc : ed_circle.extended_arcs()) {
       extended_arc.Draw(extended_arcs_image, cv::Scalar(255, 255, 0));
     }
 
@@ -174,13 +206,10 @@ void DetectCircle(cv::Mat &cv_image, bool verbose) {
 
   cv::Mat circle_and_ellipse_image = cv_image.clone();
 
-  auto circles = ed_circle.circles();
-  auto ellipses = ed_circle.ellipses();
-
-  for (auto circle : circles) {
+  for (const auto &circle : ed_circle.circles()) {
     circle.Draw(circle_and_ellipse_image, cv::Scalar(255, 255, 0));
   }
-  for (auto ellipse : ellipses) {
+  for (const auto &ellipse : ed_circle.ellipses()) {
     ellipse.Draw(circle_and_ellipse_image, cv::Scalar(0, 255, 255));
   }
 
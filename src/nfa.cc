@@ -0,0 +1,103 @@
+#include "nfa.h"
+
+#include <climits>
+#include <cmath>
+
+void BinomialNFA::Reset(double precision, double log_test_count,
+                        int max_length) {
+  if (precision != precision_ || log_test_count != log_test_count_) {
+    precision_ = precision;
+    log_precision_ = std::log(precision);
+    log_complement_ = std::log(1.0 - precision);
+    log_test_count_ = log_test_count;
+    minimum_counts_.assign(minimum_counts_.size(), -1);
+  }
+
+  PrepareLogFactorials(max_length);
+  if (int(minimum_counts_.size()) <= max_length) {
+    minimum_counts_.resize(max_length + 1, -1);
+  }
+}
+
+double BinomialNFA::LogNFA(int n, int k) {
+  if (k <= 0) {
+    return log_test_count_;
+  }
+  if (k > n) {
+    return -INFINITY;
+  }
+
+  return log_test_count_ + LogBinomialTail(n, k);
+}
+
+int BinomialNFA::MinimumMeaningfulCount(int n) {
+  if (int(minimum_counts_.size()) <= n) {
+    minimum_counts_.resize(n + 1, -1);
+  }
+
+  int& minimum_count = minimum_counts_[n];
+  if (minimum_count != -1) {
+    return minimum_count;
+  }
+
+  // LogNFA(n, n + 1) is -INFINITY, so the search always ends in [0, n + 1].
+  int low = 0;
+  int high = n + 1;
+  while (low < high) {
+    int k = low + (high - low) / 2;
+    if (LogNFA(n, k) <= 0.0) {
+      high = k;
+    } else {
+      low = k + 1;
+    }
+  }
+
+  // Every k <= 0 shares the NFA of k = 0.
+  minimum_count = low > 0 ? low : INT_MIN;
+  return minimum_count;
+}
+
+// log P[X >= k] for X ~ B(n, p). The terms from k on follow
+// t(i + 1) = t(i) * (n - i) / (i + 1) * p / (1 - p), so the sum is taken
+// relative to t(k) and rescaled whenever it grows large. Once the terms are
+// decreasing, the rest of the tail is bounded by a geometric series and the
+// loop stops as soon as that bound falls below double precision.
+double BinomialNFA::LogBinomialTail(int n, int k) {
+  PrepareLogFactorials(n);
+
+  double log_term = log_factorials_[n] - log_factorials_[k] -
+                    log_factorials_[n - k] + k * log_precision_ +
+                    (n - k) * log_complement_;
+  double odds = precision_ / (1.0 - precision_);
+
+  double term = 1.0;
+  double sum = 1.0;
+
+  for (auto i = k; i < n; ++i) {
+    double ratio = double(n - i) / double(i + 1) * odds;
+    term *= ratio;
+    sum += term;
+
+    if (ratio < 1.0 && term * ratio / (1.0 - ratio) < sum * 1e-16) {
+      break;
+    }
+
+    if (sum > 1e200) {
+      log_term += std::log(sum);
+      term /= sum;
+      sum = 1.0;
+    }
+  }
+
+  return log_term + std::log(sum);
+}
+
+void BinomialNFA::PrepareLogFactorials(int n) {
+  if (log_factorials_.empty() == true) {
+    log_factorials_.push_back(0.0);
+  }
+
+  for (auto i = int(log_factorials_.size()); i <= n; ++i) {
+    log_factorials_.push_back(log_factorials_[i - 1] + std::log(double(i)));
+  }
+}
@@ -0,0 +1,38 @@
+#ifndef NFA_H_
+#define NFA_H_
+
+#include <vector>
+
+// Number of false alarms of an a contrario alignment test: a run of n
+// samples of which k are aligned, each independently with probability p,
+// among test_count tests. Everything is kept in log space, so long runs
+// neither overflow nor underflow. The NFA decreases with k, so IsMeaningful
+// only needs the smallest meaningful k of each n; those are kept in a table
+// indexed by n that survives Reset as long as the test does not change.
+class BinomialNFA {
+ public:
+  // max_length sizes the log-factorial table, usually to the image diagonal;
+  // longer runs grow it on demand.
+  void Reset(double precision, double log_test_count, int max_length);
+
+  double LogNFA(int n, int k);
+  bool IsMeaningful(int n, int k) { return k >= MinimumMeaningfulCount(n); }
+
+ protected:
+  double LogBinomialTail(int n, int k);
+  void PrepareLogFactorials(int n);
+  int MinimumMeaningfulCount(int n);
+
+ protected:
+  double precision_ = 0.0;
+  double log_precision_ = 0.0;
+  double log_complement_ = 0.0;
+  double log_test_count_ = 0.0;
+
+  std::vector<double> log_factorials_;
+  // Smallest k with LogNFA(n, k) <= 0, or -1 when not computed yet.
+  // INT_MIN when any k is meaningful.
+  std::vector<int> minimum_counts_;
+};
+
+#endif
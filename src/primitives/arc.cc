@@ -1,27 +1,45 @@
 #include "arc.h"
 
-Arc::Arc(const std::vector<Line>& lines)
-    : lines_(lines), fitted_circle_(Circle::FitFromLines(lines)) {
+Arc::Arc(const std::vector<Line>& line_store, std::size_t begin,
+         std::size_t end)
+    : line_store_(&line_store),
+      begin_(begin),
+      end_(end),
+      fitted_circle_(0.0f, 0.0f, 0.0f, 0.0f) {
+  fitter_.Add(this->begin(), this->end());
+  fitted_circle_ = fitter_.FitCircle(this->begin(), this->end());
+
   length_ = 0.0f;
-  for (const auto& line : lines_) {
+  for (const auto& line : *this) {
     length_ += line.length();
   }
 }
 
-Arc::Arc(const std::vector<Line>& lines, const Circle& fitted_circle)
-    : lines_(lines), fitted_circle_(fitted_circle) {
+Arc::Arc(const std::vector<Line>& line_store, std::size_t begin,
+         std::size_t end, const ConicFitter& fitter)
+    : line_store_(&line_store),
+      begin_(begin),
+      end_(end),
+      fitter_(fitter),
+      fitted_circle_(fitter.FitCircle(this->begin(), this->end())) {
   length_ = 0.0f;
-  for (const auto& line : lines_) {
+  for (const auto& line : *this) {
     length_ += line.length();
   }
 }
 
+void Arc::Rebind(const std::vector<Line> &from, const std::vector<Line> &to) {
+  if (line_store_ == &from) {
+    line_store_ = &to;
+  }
+}
+
 float Arc::ComputeNearestDistanceWithEndPoint(const Arc& other) const {
-  Position p0 = lines_.front().begin();
-  Position p1 = lines_.back().end();
+  Position p0 = begin()->begin();
+  Position p1 = (end() - 1)->end();
 
-  Position o_p0 = other.lines_.front().begin();
-  Position o_p1 = other.lines_.back().end();
+  Position o_p0 = other.begin()->begin();
+  Position o_p1 = (other.end() - 1)->end();
 
   float nearest_distance = FLT_MAX;
 
@@ -33,8 +51,8 @@ float Arc::ComputeNearestDistanceWithEndPoint(const Arc& other) const {
   return nearest_distance;
 }
 
-void Arc::Draw(cv::Mat& image, cv::Scalar color) {
-  for (auto line : lines_) {
+void Arc::Draw(cv::Mat& image, cv::Scalar color) const {
+  for (const auto& line : *this) {
     line.Draw(image, color);
   }
 }
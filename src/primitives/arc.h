@@ -6,25 +6,41 @@
 
 #include "../types.h"
 #include "circle.h"
+#include "conic_fitter.h"
 #include "line.h"
 
+// Non-owning view of the lines [begin, end) of a line store. The store only
+// has to outlive the arc; it may grow while the arc exists. The arc keeps the
+// moments of its pixels so that circle and ellipse merges can be tried
+// without them.
 class Arc {
  public:
-  Arc(const std::vector<Line> &lines);
-  Arc(const std::vector<Line> &lines, const Circle &fitted_circle);
+  Arc(const std::vector<Line> &line_store, std::size_t begin, std::size_t end);
+  Arc(const std::vector<Line> &line_store, std::size_t begin, std::size_t end,
+      const ConicFitter &fitter);
 
  public:
+  // Points the arc at `to` if it views `from`, after the two stores swapped
+  // their lines.
+  void Rebind(const std::vector<Line> &from, const std::vector<Line> &to);
   float ComputeNearestDistanceWithEndPoint(const Arc &other) const;
-  void Draw(cv::Mat &image, cv::Scalar color);
+  void Draw(cv::Mat &image, cv::Scalar color) const;
 
   Circle fitted_circle() const;
+  const ConicFitter &fitter() const { return fitter_; }
   float length() const;
-  std::vector<Line> lines() { return lines_; }
+
+  const Line *begin() const { return line_store_->data() + begin_; }
+  const Line *end() const { return line_store_->data() + end_; }
+  std::size_t size() const { return end_ - begin_; }
 
  protected:
+  const std::vector<Line> *line_store_;
+  std::size_t begin_;
+  std::size_t end_;
+  ConicFitter fitter_;
   Circle fitted_circle_;
-  std::vector<Line> lines_;
   float length_;
 };
 
-#endif
\ No newline at end of file
+#endif
@@ -17,12 +17,13 @@ class Circle {
   float get_radius() const;
   float get_circumference() const;
   Position get_positionAt(float degree) const;
+  float ComputeError(Position position) const;
 
-  void Draw(cv::Mat &image, cv::Scalar color);
+  void Draw(cv::Mat &image, cv::Scalar color) const;
 
  public:
   static Circle FitFromEdgeSegment(const EdgeSegment &edge_segment);
-  static Circle FitFromLines(const std::vector<Line> &lines);
+  static Circle FitFromLines(const Line *first, const Line *last);
 
  protected:
   float parameters_[3] = {0.0f, 0.0f, 0.0f};
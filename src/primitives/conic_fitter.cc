@@ -0,0 +1,570 @@
+#include "conic_fitter.h"
+
+#define _USE_MATH_DEFINES
+#include <math.h>
+
+#include <algorithm>
+#include <limits>
+
+void ConicFitter::Reset() { *this = ConicFitter(); }
+
+void ConicFitter::Add(const Position& position) {
+  std::int64_t x = position.x;
+  std::int64_t y = position.y;
+
+  count_++;
+  sum_x_ += x;
+  sum_y_ += y;
+  sum_xx_ += x * x;
+  sum_xy_ += x * y;
+  sum_yy_ += y * y;
+  sum_xxx_ += x * x * x;
+  sum_xxy_ += x * x * y;
+  sum_xyy_ += x * y * y;
+  sum_yyy_ += y * y * y;
+
+  double xx = double(x * x);
+  double xy = double(x * y);
+  double yy = double(y * y);
+  sum_xxxx_ += xx * xx;
+  sum_xxxy_ += xx * xy;
+  sum_xxyy_ += xx * yy;
+  sum_xyyy_ += xy * yy;
+  sum_yyyy_ += yy * yy;
+}
+
+void ConicFitter::Add(const EdgeSegment& edge_segment) {
+  for (const auto& e : edge_segment) {
+    Add(e.position);
+  }
+}
+
+void ConicFitter::Add(const Line* first, const Line* last) {
+  for (auto line = first; line != last; ++line) {
+    Add(line->edge_segment());
+  }
+}
+
+void ConicFitter::Add(const ConicFitter& other) {
+  count_ += other.count_;
+  sum_x_ += other.sum_x_;
+  sum_y_ += other.sum_y_;
+  sum_xx_ += other.sum_xx_;
+  sum_xy_ += other.sum_xy_;
+  sum_yy_ += other.sum_yy_;
+  sum_xxx_ += other.sum_xxx_;
+  sum_xxy_ += other.sum_xxy_;
+  sum_xyy_ += other.sum_xyy_;
+  sum_yyy_ += other.sum_yyy_;
+  sum_xxxx_ += other.sum_xxxx_;
+  sum_xxxy_ += other.sum_xxxy_;
+  sum_xxyy_ += other.sum_xxyy_;
+  sum_xyyy_ += other.sum_xyyy_;
+  sum_yyyy_ += other.sum_yyyy_;
+}
+
+float ConicFitter::circle_fitting_error() const {
+  double center_x = 0.0;
+  double center_y = 0.0;
+  double radius = 0.0;
+  double error = 0.0;
+
+  SolveCircle(center_x, center_y, radius, error);
+
+  return float(error);
+}
+
+float ConicFitter::ellipse_fitting_error() const {
+  double conic[6];
+  double error = 0.0;
+
+  if (SolveEllipse(conic, error) == false) {
+    return std::numeric_limits<float>::infinity();
+  }
+
+  return float(error);
+}
+
+namespace {
+
+// Both estimates take the RMS distance, scaled to the mean distance of
+// normally distributed residuals to compare with the exact error.
+const double kRmsToMean = 0.7978845608;  // sqrt(2 / pi)
+
+const EdgeSegment& EdgelsOf(const EdgeSegment& edge_segment) {
+  return edge_segment;
+}
+
+const EdgeSegment& EdgelsOf(const Line& line) { return line.edge_segment(); }
+
+template <typename Shape, typename Run>
+float MeanError(const Shape& shape, std::int64_t count, const Run* first,
+                const Run* last) {
+  float error = 0.0f;
+  for (auto run = first; run != last; ++run) {
+    for (const auto& edge : EdgelsOf(*run)) {
+      error += shape.ComputeError(edge.position);
+    }
+  }
+
+  return error / float(count);
+}
+
+// Ellipse errors go through the batched FastMath calls; the sum keeps the
+// order of the generic version.
+template <typename Run>
+float MeanError(const Ellipse& ellipse, std::int64_t count, const Run* first,
+                const Run* last) {
+  const std::size_t kBatchSize = Ellipse::kErrorBatchSize;
+  float errors[kBatchSize];
+
+  float error = 0.0f;
+  for (auto run = first; run != last; ++run) {
+    const EdgeSegment& edgels = EdgelsOf(*run);
+    for (std::size_t i = 0; i < edgels.size(); i += kBatchSize) {
+      std::size_t batch_size = std::min(kBatchSize, edgels.size() - i);
+      ellipse.ComputeError(edgels.begin() + i, batch_size, errors);
+      for (std::size_t j = 0; j < batch_size; j++) {
+        error += errors[j];
+      }
+    }
+  }
+
+  return error / float(count);
+}
+
+template <typename Run>
+Circle FitCircleToRuns(double center_x, double center_y, double radius,
+                       std::int64_t count, const Run* first, const Run* last) {
+  Circle circle(float(center_x), float(center_y), float(radius), 0.0f);
+
+  return Circle(float(center_x), float(center_y), float(radius),
+                MeanError(circle, count, first, last));
+}
+
+template <typename Run>
+Ellipse FitEllipseToRuns(const double conic[6], bool is_solved,
+                         std::int64_t count, const Run* first,
+                         const Run* last) {
+  float a = float(conic[0]);
+  float b = float(conic[1]);
+  float c = float(conic[2]);
+  float d = float(conic[3]);
+  float e = float(conic[4]);
+  float f = float(conic[5]);
+
+  if (is_solved == false) {
+    return Ellipse(a, b, c, d, e, f, std::numeric_limits<float>::infinity());
+  }
+
+  Ellipse ellipse(a, b, c, d, e, f, 0.0f);
+
+  return Ellipse(a, b, c, d, e, f,
+                 MeanError(ellipse, count, first, last));
+}
+
+// 3x3 inverse by the adjugate; false when singular.
+bool Invert3x3(const double m[3][3], double inverse[3][3]) {
+  double c00 = m[1][1] * m[2][2] - m[1][2] * m[2][1];
+  double c01 = m[1][2] * m[2][0] - m[1][0] * m[2][2];
+  double c02 = m[1][0] * m[2][1] - m[1][1] * m[2][0];
+  double determinant = m[0][0] * c00 + m[0][1] * c01 + m[0][2] * c02;
+
+  if (std::abs(determinant) <= std::numeric_limits<double>::min()) {
+    return false;
+  }
+
+  double inverse_determinant = 1.0 / determinant;
+
+  inverse[0][0] = c00 * inverse_determinant;
+  inverse[1][0] = c01 * inverse_determinant;
+  inverse[2][0] = c02 * inverse_determinant;
+  inverse[0][1] = (m[0][2] * m[2][1] - m[0][1] * m[2][2]) * inverse_determinant;
+  inverse[1][1] = (m[0][0] * m[2][2] - m[0][2] * m[2][0]) * inverse_determinant;
+  inverse[2][1] = (m[0][1] * m[2][0] - m[0][0] * m[2][1]) * inverse_determinant;
+  inverse[0][2] = (m[0][1] * m[1][2] - m[0][2] * m[1][1]) * inverse_determinant;
+  inverse[1][2] = (m[0][2] * m[1][0] - m[0][0] * m[1][2]) * inverse_determinant;
+  inverse[2][2] = (m[0][0] * m[1][1] - m[0][1] * m[1][0]) * inverse_determinant;
+
+  return true;
+}
+
+// Real eigenvalues of a general 3x3 matrix, from its characteristic cubic.
+int RealEigenvalues(const double m[3][3], double eigenvalues[3]) {
+  double trace = m[0][0] + m[1][1] + m[2][2];
+  double minors = m[0][0] * m[1][1] - m[0][1] * m[1][0] +
+                  m[0][0] * m[2][2] - m[0][2] * m[2][0] +
+                  m[1][1] * m[2][2] - m[1][2] * m[2][1];
+  double determinant =
+      m[0][0] * (m[1][1] * m[2][2] - m[1][2] * m[2][1]) -
+      m[0][1] * (m[1][0] * m[2][2] - m[1][2] * m[2][0]) +
+      m[0][2] * (m[1][0] * m[2][1] - m[1][1] * m[2][0]);
+
+  // lambda^3 - trace lambda^2 + minors lambda - determinant, depressed by
+  // lambda = t + trace / 3 to t^3 + p t + q.
+  double shift = trace / 3.0;
+  double p = minors - trace * shift;
+  double q = -2.0 * shift * shift * shift + minors * shift - determinant;
+  double discriminant = q * q / 4.0 + p * p * p / 27.0;
+
+  if (discriminant > 0.0) {
+    double root = std::sqrt(discriminant);
+    eigenvalues[0] = std::cbrt(-q / 2.0 + root) + std::cbrt(-q / 2.0 - root) +
+                     shift;
+    return 1;
+  }
+
+  double radius = std::sqrt(-p / 3.0);
+  double cosine = radius > 0.0 ? -q / (2.0 * radius * radius * radius) : 0.0;
+  double phi = std::acos(std::max(-1.0, std::min(1.0, cosine)));
+
+  for (int k = 0; k < 3; ++k) {
+    eigenvalues[k] =
+        2.0 * radius * std::cos((phi - 2.0 * M_PI * k) / 3.0) + shift;
+  }
+
+  return 3;
+}
+
+// Null vector of m - eigenvalue * I as the largest cross product of two of
+// its rows.
+void Eigenvector(const double m[3][3], double eigenvalue, double vector[3]) {
+  double rows[3][3];
+  for (int i = 0; i < 3; ++i) {
+    for (int j = 0; j < 3; ++j) {
+      rows[i][j] = m[i][j] - (i == j ? eigenvalue : 0.0);
+    }
+  }
+
+  double best_norm = -1.0;
+  for (int i = 0; i < 3; ++i) {
+    const double* r0 = rows[i];
+    const double* r1 = rows[(i + 1) % 3];
+    double cross[3] = {r0[1] * r1[2] - r0[2] * r1[1],
+                       r0[2] * r1[0] - r0[0] * r1[2],
+                       r0[0] * r1[1] - r0[1] * r1[0]};
+    double norm = cross[0] * cross[0] + cross[1] * cross[1] +
+                  cross[2] * cross[2];
+
+    if (norm > best_norm) {
+      best_norm = norm;
+      std::copy(cross, cross + 3, vector);
+    }
+  }
+}
+
+}  // namespace
+
+Circle ConicFitter::FitCircle(const EdgeSegment& edge_segment) const {
+  double center_x = 0.0;
+  double center_y = 0.0;
+  double radius = 0.0;
+  double error = 0.0;
+
+  SolveCircle(center_x, center_y, radius, error);
+
+  return FitCircleToRuns(center_x, center_y, radius, count_, &edge_segment,
+                         &edge_segment + 1);
+}
+
+Circle ConicFitter::FitCircle(const Line* first, const Line* last) const {
+  double center_x = 0.0;
+  double center_y = 0.0;
+  double radius = 0.0;
+  double error = 0.0;
+
+  SolveCircle(center_x, center_y, radius, error);
+
+  return FitCircleToRuns(center_x, center_y, radius, count_, first, last);
+}
+
+Ellipse ConicFitter::FitEllipse(const EdgeSegment& edge_segment) const {
+  double conic[6] = {0.0, 0.0, 0.0, 0.0, 0.0, 0.0};
+  double error = 0.0;
+  bool is_solved = SolveEllipse(conic, error);
+
+  return FitEllipseToRuns(conic, is_solved, count_, &edge_segment,
+                          &edge_segment + 1);
+}
+
+Ellipse ConicFitter::FitEllipse(const Line* first, const Line* last) const {
+  double conic[6] = {0.0, 0.0, 0.0, 0.0, 0.0, 0.0};
+  double error = 0.0;
+  bool is_solved = SolveEllipse(conic, error);
+
+  return FitEllipseToRuns(conic, is_solved, count_, first, last);
+}
+
+// Solves the Kasa fit in coordinates (u, v) centred on the mean, from the raw
+// moments. With z = u^2 + v^2, the centre (a, b) solves
+//   [S_uu S_uv] [a]   [(S_uuu + S_uvv) / 2]
+//   [S_uv S_vv] [b] = [(S_uuv + S_vvv) / 2]
+// and r^2 = a^2 + b^2 + mean(z). The residual z - mean(z) - 2au - 2bv then
+// has the sum of squares S_(z-mean(z))^2 - 4 (a, b) . rhs.
+void ConicFitter::SolveCircle(double& center_x, double& center_y,
+                              double& radius, double& error) const {
+  if (count_ == 0) {
+    return;
+  }
+
+  double n = double(count_);
+  double sum_x = double(sum_x_);
+  double sum_y = double(sum_y_);
+  double sum_xx = double(sum_xx_);
+  double sum_xy = double(sum_xy_);
+  double sum_yy = double(sum_yy_);
+  double mean_x = sum_x / n;
+  double mean_y = sum_y / n;
+
+  double s_uu = sum_xx - sum_x * mean_x;
+  double s_vv = sum_yy - sum_y * mean_y;
+  double s_uv = sum_xy - sum_x * mean_y;
+  double s_uuu = double(sum_xxx_) - 3.0 * mean_x * sum_xx +
+                 2.0 * n * mean_x * mean_x * mean_x;
+  double s_vvv = double(sum_yyy_) - 3.0 * mean_y * sum_yy +
+                 2.0 * n * mean_y * mean_y * mean_y;
+  double s_uvv = double(sum_xyy_) - 2.0 * mean_y * sum_xy - mean_x * sum_yy +
+                 2.0 * n * mean_x * mean_y * mean_y;
+  double s_uuv = double(sum_xxy_) - 2.0 * mean_x * sum_xy - mean_y * sum_xx +
+                 2.0 * n * mean_x * mean_x * mean_y;
+
+  double rhs_u = (s_uuu + s_uvv) / 2.0;
+  double rhs_v = (s_uuv + s_vvv) / 2.0;
+  double determinant = s_uu * s_vv - s_uv * s_uv;
+
+  double a = (s_vv * rhs_u - s_uv * rhs_v) / determinant;
+  double b = (s_uu * rhs_v - s_uv * rhs_u) / determinant;
+  double mean_z = (s_uu + s_vv) / n;
+
+  center_x = a + mean_x;
+  center_y = b + mean_y;
+  radius = std::sqrt(a * a + b * b + mean_z);
+
+  // z = w - l with w = x^2 + y^2 and l = 2 mean_x x + 2 mean_y y - k.
+  double k = mean_x * mean_x + mean_y * mean_y;
+  double sum_ww = sum_xxxx_ + 2.0 * sum_xxyy_ + sum_yyyy_;
+  double sum_w = sum_xx + sum_yy;
+  double sum_wx = double(sum_xxx_) + double(sum_xyy_);
+  double sum_wy = double(sum_xxy_) + double(sum_yyy_);
+  double sum_wl =
+      2.0 * mean_x * sum_wx + 2.0 * mean_y * sum_wy - k * sum_w;
+  double sum_ll = 4.0 * (mean_x * mean_x * sum_xx +
+                         2.0 * mean_x * mean_y * sum_xy +
+                         mean_y * mean_y * sum_yy) -
+                  4.0 * k * (mean_x * sum_x + mean_y * sum_y) + n * k * k;
+  double sum_zz = sum_ww - 2.0 * sum_wl + sum_ll;
+
+  double residual =
+      std::max(sum_zz - n * mean_z * mean_z - 4.0 * (a * rhs_u + b * rhs_v),
+               0.0);
+
+  error = kRmsToMean * std::sqrt(residual / n) / (2.0 * radius);
+}
+
+// Fits in coordinates (u, v) centred on the mean and scaled to unit spread,
+// whose moments follow from the raw ones by binomial expansion. With the
+// scatter matrix split into the quadratic (S1), mixed (S2) and linear (S3)
+// blocks, the quadratic coefficients a1 are the eigenvector of
+// C1^-1 (S1 - S2 S3^-1 S2^T) with 4 a c - b^2 > 0, and the linear ones are
+// a2 = -S3^-1 S2^T a1.
+bool ConicFitter::SolveEllipse(double conic[6], double& error) const {
+  if (count_ < 6) {
+    return false;
+  }
+
+  double n = double(count_);
+  double raw[5][5] = {};
+  raw[0][0] = n;
+  raw[1][0] = double(sum_x_);
+  raw[0][1] = double(sum_y_);
+  raw[2][0] = double(sum_xx_);
+  raw[1][1] = double(sum_xy_);
+  raw[0][2] = double(sum_yy_);
+  raw[3][0] = double(sum_xxx_);
+  raw[2][1] = double(sum_xxy_);
+  raw[1][2] = double(sum_xyy_);
+  raw[0][3] = double(sum_yyy_);
+  raw[4][0] = sum_xxxx_;
+  raw[3][1] = sum_xxxy_;
+  raw[2][2] = sum_xxyy_;
+  raw[1][3] = sum_xyyy_;
+  raw[0][4] = sum_yyyy_;
+
+  double mean_x = raw[1][0] / n;
+  double mean_y = raw[0][1] / n;
+
+  const double kBinomials[5][5] = {{1, 0, 0, 0, 0},
+                                   {1, 1, 0, 0, 0},
+                                   {1, 2, 1, 0, 0},
+                                   {1, 3, 3, 1, 0},
+                                   {1, 4, 6, 4, 1}};
+  double powers_x[5] = {1.0, -mean_x, mean_x * mean_x, 0.0, 0.0};
+  double powers_y[5] = {1.0, -mean_y, mean_y * mean_y, 0.0, 0.0};
+  for (int i = 3; i < 5; ++i) {
+    powers_x[i] = powers_x[i - 1] * -mean_x;
+    powers_y[i] = powers_y[i - 1] * -mean_y;
+  }
+
+  // Mean of u^p v^q over the points.
+  double moments[5][5] = {};
+  for (int p = 0; p < 5; ++p) {
+    for (int q = 0; p + q < 5; ++q) {
+      double sum = 0.0;
+      for (int i = 0; i <= p; ++i) {
+        for (int j = 0; j <= q; ++j) {
+          sum += kBinomials[p][i] * kBinomials[q][j] * powers_x[p - i] *
+                 powers_y[q - j] * raw[i][j];
+        }
+      }
+      moments[p][q] = sum / n;
+    }
+  }
+
+  double scale = std::sqrt((moments[2][0] + moments[0][2]) / 2.0);
+  if (!(scale > 0.0)) {
+    return false;
+  }
+
+  double scale_power = 1.0;
+  for (int order = 1; order < 5; ++order) {
+    scale_power *= scale;
+    for (int p = 0; p <= order; ++p) {
+      moments[p][order - p] /= scale_power;
+    }
+  }
+
+  // Exponents of the monomials u^2, uv, v^2, u, v, 1.
+  const int kExponents[6][2] = {{2, 0}, {1, 1}, {0, 2},
+                                {1, 0}, {0, 1}, {0, 0}};
+  double scatter[6][6];
+  for (int i = 0; i < 6; ++i) {
+    for (int j = 0; j < 6; ++j) {
+      scatter[i][j] = moments[kExponents[i][0] + kExponents[j][0]]
+                             [kExponents[i][1] + kExponents[j][1]];
+    }
+  }
+
+  double s3[3][3];
+  for (int i = 0; i < 3; ++i) {
+    for (int j = 0; j < 3; ++j) {
+      s3[i][j] = scatter[i + 3][j + 3];
+    }
+  }
+
+  double s3_inverse[3][3];
+  if (Invert3x3(s3, s3_inverse) == false) {
+    return false;
+  }
+
+  // t = -S3^-1 S2^T, reduced = S1 + S2 t.
+  double t[3][3];
+  for (int i = 0; i < 3; ++i) {
+    for (int j = 0; j < 3; ++j) {
+      double sum = 0.0;
+      for (int k = 0; k < 3; ++k) {
+        sum += s3_inverse[i][k] * scatter[j][k + 3];
+      }
+      t[i][j] = -sum;
+    }
+  }
+
+  double reduced[3][3];
+  for (int i = 0; i < 3; ++i) {
+    for (int j = 0; j < 3; ++j) {
+      double sum = scatter[i][j];
+      for (int k = 0; k < 3; ++k) {
+        sum += scatter[i][k + 3] * t[k][j];
+      }
+      reduced[i][j] = sum;
+    }
+  }
+
+  // C1^-1 of the constraint matrix [0 0 2; 0 -1 0; 2 0 0].
+  double m[3][3];
+  for (int j = 0; j < 3; ++j) {
+    m[0][j] = reduced[2][j] / 2.0;
+    m[1][j] = -reduced[1][j];
+    m[2][j] = reduced[0][j] / 2.0;
+  }
+
+  double eigenvalues[3];
+  int eigenvalue_count = RealEigenvalues(m, eigenvalues);
+
+  // Of the eigenvectors meeting the ellipse constraint, the one with the
+  // smallest algebraic residual per unit of constraint.
+  double best_cost = std::numeric_limits<double>::infinity();
+  for (int k = 0; k < eigenvalue_count; ++k) {
+    double a1[3];
+    Eigenvector(m, eigenvalues[k], a1);
+
+    double constraint = 4.0 * a1[0] * a1[2] - a1[1] * a1[1];
+    if (!(constraint > 0.0)) {
+      continue;
+    }
+
+    double cost = 0.0;
+    for (int i = 0; i < 3; ++i) {
+      for (int j = 0; j < 3; ++j) {
+        cost += a1[i] * reduced[i][j] * a1[j];
+      }
+    }
+    cost /= constraint;
+
+    if (cost < best_cost) {
+      best_cost = cost;
+      std::copy(a1, a1 + 3, conic);
+    }
+  }
+
+  if (best_cost == std::numeric_limits<double>::infinity()) {
+    return false;
+  }
+
+  for (int i = 0; i < 3; ++i) {
+    conic[i + 3] = t[i][0] * conic[0] + t[i][1] * conic[1] + t[i][2] * conic[2];
+  }
+
+  // Sampson distance: mean squared residual over the mean squared gradient
+  // (2 A u + B v + D, B u + 2 C v + E) of the conic, in units of the scale.
+  double residual = 0.0;
+  for (int i = 0; i < 6; ++i) {
+    for (int j = 0; j < 6; ++j) {
+      residual += conic[i] * scatter[i][j] * conic[j];
+    }
+  }
+
+  const double gradients[2][3] = {{2.0 * conic[0], conic[1], conic[3]},
+                                  {conic[1], 2.0 * conic[2], conic[4]}};
+  double gradient = 0.0;
+  for (const auto& g : gradients) {
+    gradient += g[0] * g[0] * moments[2][0] +
+                2.0 * g[0] * g[1] * moments[1][1] +
+                g[1] * g[1] * moments[0][2] +
+                2.0 * g[0] * g[2] * moments[1][0] +
+                2.0 * g[1] * g[2] * moments[0][1] + g[2] * g[2];
+  }
+
+  error = kRmsToMean * scale * std::sqrt(std::max(residual, 0.0) / gradient);
+
+  // Back to image coordinates, u = (x - mean_x) / scale, with the quadratic
+  // part positive definite.
+  double a = conic[0];
+  double b = conic[1];
+  double c = conic[2];
+  double d = conic[3] * scale;
+  double e = conic[4] * scale;
+  double f = conic[5] * scale * scale;
+
+  conic[3] = d - 2.0 * a * mean_x - b * mean_y;
+  conic[4] = e - b * mean_x - 2.0 * c * mean_y;
+  conic[5] = f + a * mean_x * mean_x + b * mean_x * mean_y +
+             c * mean_y * mean_y - d * mean_x - e * mean_y;
+
+  if (a < 0.0) {
+    for (int i = 0; i < 6; ++i) {
+      conic[i] = -conic[i];
+    }
+  }
+
+  return true;
+}
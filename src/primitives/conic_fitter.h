@@ -0,0 +1,68 @@
+#ifndef PRIMITIVES__CONIC_FITTER_H_
+#define PRIMITIVES__CONIC_FITTER_H_
+
+#include <cstdint>
+
+#include "../types.h"
+#include "circle.h"
+#include "edge_segment.h"
+#include "ellipse.h"
+#include "line.h"
+
+// Least-squares circle and ellipse over a set of edgels, both solved from the
+// raw moments of the points up to the fourth order: the algebraic (Kasa)
+// circle, and the direct ellipse of Fitzgibbon in the numerically stable form
+// of Halir and Flusser. Two fitters over disjoint point sets merge in O(1),
+// so trial merges of arcs need no pass over their pixels. The moments up to
+// the third order are exact integers; the fourth order ones would overflow
+// them on large images and are doubles.
+class ConicFitter {
+ public:
+  void Reset();
+  void Add(const Position& position);
+  void Add(const EdgeSegment& edge_segment);
+  void Add(const Line* first, const Line* last);
+  void Add(const ConicFitter& other);
+
+  std::int64_t count() const { return count_; }
+
+  // Estimate of the mean distance of the points to the circle, from the RMS
+  // of the algebraic residual (x - a)^2 + (y - b)^2 - r^2 divided by 2r.
+  float circle_fitting_error() const;
+
+  // Estimate of the mean distance of the points to the ellipse, from the
+  // algebraic residual over the gradient of the conic (Sampson distance).
+  // Infinite when no ellipse fits.
+  float ellipse_fitting_error() const;
+
+  // The fitted shapes, with their error measured exactly as the mean distance
+  // of the points to them. The runs must hold exactly the accumulated points.
+  Circle FitCircle(const EdgeSegment& edge_segment) const;
+  Circle FitCircle(const Line* first, const Line* last) const;
+  Ellipse FitEllipse(const EdgeSegment& edge_segment) const;
+  Ellipse FitEllipse(const Line* first, const Line* last) const;
+
+ protected:
+  void SolveCircle(double& center_x, double& center_y, double& radius,
+                   double& error) const;
+  bool SolveEllipse(double conic[6], double& error) const;
+
+ protected:
+  std::int64_t count_ = 0;
+  std::int64_t sum_x_ = 0;
+  std::int64_t sum_y_ = 0;
+  std::int64_t sum_xx_ = 0;
+  std::int64_t sum_xy_ = 0;
+  std::int64_t sum_yy_ = 0;
+  std::int64_t sum_xxx_ = 0;
+  std::int64_t sum_xxy_ = 0;
+  std::int64_t sum_xyy_ = 0;
+  std::int64_t sum_yyy_ = 0;
+  double sum_xxxx_ = 0.0;
+  double sum_xxxy_ = 0.0;
+  double sum_xxyy_ = 0.0;
+  double sum_xyyy_ = 0.0;
+  double sum_yyyy_ = 0.0;
+};
+
+#endif
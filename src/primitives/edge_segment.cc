@@ -1,5 +1,8 @@
 #include "edge_segment.h"
 
+EdgeSegment::EdgeSegment(const Edgel* begin, const Edgel* end)
+    : begin_(begin), end_(end) {}
+
 bool EdgeSegment::isClosed() const {
   auto first_edge = front();
   auto last_edge = back();
@@ -14,7 +17,7 @@ bool EdgeSegment::isClosed() const {
   }
 }
 
-void EdgeSegment::Draw(cv::Mat& image, cv::Scalar color) {
+void EdgeSegment::Draw(cv::Mat& image, cv::Scalar color) const {
   int type = image.type();
 
   if (type == CV_8UC1) {
@@ -28,3 +31,27 @@ void EdgeSegment::Draw(cv::Mat& image, cv::Scalar color) {
     }
   }
 }
+
+EdgeSegmentStore::EdgeSegmentStore() : offsets_(1, 0) {}
+
+void EdgeSegmentStore::clear() {
+  pixels_.clear();
+  offsets_.resize(1);
+}
+
+void EdgeSegmentStore::swap(EdgeSegmentStore& other) {
+  pixels_.swap(other.pixels_);
+  offsets_.swap(other.offsets_);
+}
+
+void EdgeSegmentStore::AddSegment(const EdgeSegment& segment) {
+  AddPixels(segment.begin(), segment.end());
+  CloseSegment();
+}
+
+void EdgeSegmentStore::CloseSegment() { offsets_.push_back(pixels_.size()); }
+
+EdgeSegment EdgeSegmentStore::operator[](std::size_t index) const {
+  const Edgel* pixels = pixels_.data();
+  return EdgeSegment(pixels + offsets_[index], pixels + offsets_[index + 1]);
+}
@@ -1,16 +1,88 @@
 #ifndef PRIMITIVES__EDGE_SEGMENT_H_
 #define PRIMITIVES__EDGE_SEGMENT_H_
 
-#include <list>
 #include <opencv2/core.hpp>
+#include <vector>
 
 #include "../types.h"
 
-class EdgeSegment : public std::list<Edgel> {
+// Non-owning view of a run of edgels, usually a chain in an EdgeSegmentStore.
+class EdgeSegment {
  public:
+  EdgeSegment() = default;
+  EdgeSegment(const Edgel* begin, const Edgel* end);
+
+ public:
+  const Edgel* begin() const { return begin_; }
+  const Edgel* end() const { return end_; }
+  std::size_t size() const { return std::size_t(end_ - begin_); }
+  bool empty() const { return begin_ == end_; }
+
+  const Edgel& front() const { return *begin_; }
+  const Edgel& back() const { return *(end_ - 1); }
+  const Edgel& operator[](std::size_t index) const { return begin_[index]; }
+
   bool isClosed() const;
-  void Draw(cv::Mat &image, cv::Scalar color);
+  void Draw(cv::Mat& image, cv::Scalar color) const;
+
+ protected:
+  const Edgel* begin_ = nullptr;
+  const Edgel* end_ = nullptr;
+};
+
+// All edge segments of a frame in one pixel array. Segment i spans
+// pixels_[offsets_[i]] to pixels_[offsets_[i + 1]]; pixels added since the
+// last CloseSegment belong to the segment being built.
+class EdgeSegmentStore {
+ public:
+  class const_iterator {
+   public:
+    const_iterator(const EdgeSegmentStore* store, std::size_t index)
+        : store_(store), index_(index) {}
+
+    EdgeSegment operator*() const { return (*store_)[index_]; }
+    const_iterator& operator++() {
+      ++index_;
+      return *this;
+    }
+    bool operator!=(const const_iterator& other) const {
+      return index_ != other.index_;
+    }
 
+   protected:
+    const EdgeSegmentStore* store_;
+    std::size_t index_;
+  };
+
+ public:
+  EdgeSegmentStore();
+
+ public:
+  void clear();
+  void swap(EdgeSegmentStore& other);
+
+  void AddPixel(const Edgel& edgel) { pixels_.push_back(edgel); }
+  template <typename Iterator>
+  void AddPixels(Iterator first, Iterator last);
+  void AddSegment(const EdgeSegment& segment);
+  void CloseSegment();
+
+  std::size_t size() const { return offsets_.size() - 1; }
+  bool empty() const { return size() == 0; }
+  std::size_t pixel_count() const { return offsets_.back(); }
+  EdgeSegment operator[](std::size_t index) const;
+
+  const_iterator begin() const { return const_iterator(this, 0); }
+  const_iterator end() const { return const_iterator(this, size()); }
+
+ protected:
+  std::vector<Edgel> pixels_;
+  std::vector<std::size_t> offsets_;
 };
 
-#endif
\ No newline at end of file
+template <typename Iterator>
+void EdgeSegmentStore::AddPixels(Iterator first, Iterator last) {
+  pixels_.insert(pixels_.end(), first, last);
+}
+
+#endif
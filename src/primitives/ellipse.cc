@@ -5,6 +5,9 @@
 
 #include <opencv2/imgproc.hpp>
 
+#include "../fast_math.h"
+#include "conic_fitter.h"
+
 Ellipse::Ellipse(float a, float b, float c, float d, float e, float f,
                  float fitting_error)
     : parameters_{a, b, c, d, e, f}, fitting_error_(fitting_error) {
@@ -45,12 +48,9 @@ PositionF Ellipse::get_center() const { return PositionF(cx_, cy_); }
 Position Ellipse::get_positionAt(float degree) const {
   float angle = degree / 180.0f * M_PI;
 
-  float cos_angle = cos(angle);
-  float sin_angle = sin(angle);
-
-  float new_aspect_x = cos(angle);
-  float new_aspect_y = sin(angle);
-  angle = atan2(new_aspect_y, new_aspect_x);
+  float sin_angle = 0.0f;
+  float cos_angle = 0.0f;
+  FastMath::SinCos(angle, sin_angle, cos_angle);
 
   float ideal_x = cx_ + axis_lengths_[0] * cos_angle * cos_angle_ -
                   axis_lengths_[1] * sin_angle * sin_angle_;
@@ -60,6 +60,22 @@ Position Ellipse::get_positionAt(float degree) const {
   return Position(int(ideal_x + 0.5f), int(ideal_y + 0.5f));
 }
 
+// Derivative of get_positionAt with respect to the parameter angle.
+PositionF Ellipse::get_tangentAt(float degree) const {
+  float angle = degree / 180.0f * M_PI;
+
+  float sin_angle = 0.0f;
+  float cos_angle = 0.0f;
+  FastMath::SinCos(angle, sin_angle, cos_angle);
+
+  float tangent_x = -axis_lengths_[0] * sin_angle * cos_angle_ -
+                    axis_lengths_[1] * cos_angle * sin_angle_;
+  float tangent_y = -axis_lengths_[0] * sin_angle * sin_angle_ +
+                    axis_lengths_[1] * cos_angle * cos_angle_;
+
+  return PositionF(tangent_x, tangent_y);
+}
+
 void Ellipse::Draw(cv::Mat& image, cv::Scalar color) const {
   cv::ellipse(image, cv::Point2f(cx_, cy_),
               cv::Size(axis_lengths_[0], axis_lengths_[1]),
@@ -73,92 +89,83 @@ float Ellipse::major_length() const { return axis_lengths_[0]; }
 float Ellipse::minor_length() const { return axis_lengths_[1]; }
 
 Ellipse Ellipse::FitFromEdgeSegment(const EdgeSegment& edge_segment) {
-  std::vector<cv::Point2f> points;
-  for (const auto& e : edge_segment) {
-    points.push_back(cv::Point2f(e.position.x, e.position.y));
-  }
+  ConicFitter fitter;
+  fitter.Add(edge_segment);
 
-  cv::RotatedRect rect = cv::fitEllipseDirect(points);
-
-  float major_length = 0.0f;
-  float minor_length = 0.0f;
-  float angle = 0.0f;
-
-  if (rect.size.width >= rect.size.height) {
-    major_length = rect.size.width / 2.0f;
-    minor_length = rect.size.height / 2.0f;
-    angle = rect.angle;
-  } else {
-    major_length = rect.size.height / 2.0f;
-    minor_length = rect.size.width / 2.0f;
-    angle = (90.0f + rect.angle);
-  }
+  return fitter.FitEllipse(edge_segment);
+}
 
-  angle = angle / 180.0f * M_PI;
+Ellipse Ellipse::FitFromLines(const Line* first, const Line* last) {
+  ConicFitter fitter;
+  fitter.Add(first, last);
 
-  float major_length2 = major_length * major_length;
-  float minor_length2 = minor_length * minor_length;
-  float center_x = rect.center.x;
-  float center_y = rect.center.y;
+  return fitter.FitEllipse(first, last);
+}
 
-  float cos_angle = cos(angle);
-  float cos_angle2 = cos_angle * cos_angle;
-  float sin_angle = sin(angle);
-  float sin_angle2 = sin_angle * sin_angle;
+float Ellipse::ComputeError(Position position) const {
+  float x = float(position.x);
+  float y = float(position.y);
 
-  float a = major_length2 * sin_angle2 + minor_length2 * cos_angle2;
-  float b = 2.0f * (minor_length2 - major_length2) * sin_angle * cos_angle;
-  float c = major_length2 * cos_angle2 + minor_length2 * sin_angle2;
-  float d = -2.0f * a * center_x + -1.0f * b * center_y;
-  float e = -1.0f * b * center_x + -2.0f * c * center_y;
-  float f = a * center_x * center_x + b * center_x * center_y +
-            c * center_y * center_y - major_length2 * minor_length2;
+  float degree = FastMath::Atan2(y - cy_, x - cx_) - angle_;
 
-  float parameters[6] = {a, b, c, d, e, f};
+  float sin_degree = 0.0f;
+  float cos_degree = 0.0f;
+  FastMath::SinCos(degree, sin_degree, cos_degree);
 
-  Ellipse ellipse(a, b, c, d, e, f, 0.0f);
+  float new_aspect_x = cos_degree / axis_lengths_[0];
+  float new_aspect_y = sin_degree / axis_lengths_[1];
+  degree = FastMath::Atan2(new_aspect_y, new_aspect_x);
+  FastMath::SinCos(degree, sin_degree, cos_degree);
 
-  float error = 0.0f;
+  float ideal_x = cx_ + axis_lengths_[0] * cos_degree * cos_angle_ -
+                  axis_lengths_[1] * sin_degree * sin_angle_;
+  float ideal_y = cy_ + axis_lengths_[0] * cos_degree * sin_angle_ +
+                  axis_lengths_[1] * sin_degree * cos_angle_;
 
-  for (const auto& edge : edge_segment) {
-    error += ellipse.ComputeError(edge.position);
-  }
-  error /= float(edge_segment.size());
-
-  ellipse.fitting_error_ = error;
+  float error =
+      sqrt((ideal_x - x) * (ideal_x - x) + (ideal_y - y) * (ideal_y - y));
 
-  return ellipse;
+  return error;
 }
 
-Ellipse Ellipse::FitFromLines(const std::vector<Line>& lines) {
-  EdgeSegment whole_edge_segment;
-
-  for (const auto& line : lines) {
-    EdgeSegment edge_segment = line.edge_segment();
-    whole_edge_segment.insert(whole_edge_segment.end(), edge_segment.begin(),
-                              edge_segment.end());
+void Ellipse::ComputeError(const Edgel* edgels, std::size_t count,
+                           float* errors) const {
+  float x[kErrorBatchSize];
+  float y[kErrorBatchSize];
+  float delta_x[kErrorBatchSize];
+  float delta_y[kErrorBatchSize];
+  float degrees[kErrorBatchSize];
+  float sin_degrees[kErrorBatchSize];
+  float cos_degrees[kErrorBatchSize];
+
+  for (std::size_t i = 0; i < count; i++) {
+    x[i] = float(edgels[i].position.x);
+    y[i] = float(edgels[i].position.y);
+    delta_x[i] = x[i] - cx_;
+    delta_y[i] = y[i] - cy_;
   }
 
-  return FitFromEdgeSegment(whole_edge_segment);
-}
-
-float Ellipse::ComputeError(Position position) {
-  float x = float(position.x);
-  float y = float(position.y);
-
-  float degree = atan2(y - cy_, x - cx_) - angle_;
-
-  float new_aspect_x = cos(degree) / axis_lengths_[0];
-  float new_aspect_y = sin(degree) / axis_lengths_[1];
-  degree = atan2(new_aspect_y, new_aspect_x);
+  FastMath::Atan2(delta_y, delta_x, degrees, count);
+  for (std::size_t i = 0; i < count; i++) {
+    degrees[i] -= angle_;
+  }
+  FastMath::SinCos(degrees, sin_degrees, cos_degrees, count);
 
-  float ideal_x = cx_ + axis_lengths_[0] * cos(degree) * cos_angle_ -
-                  axis_lengths_[1] * sin(degree) * sin_angle_;
-  float ideal_y = cy_ + axis_lengths_[0] * cos(degree) * sin_angle_ +
-                  axis_lengths_[1] * sin(degree) * cos_angle_;
+  // The point's direction mapped onto the unit circle of the ellipse.
+  for (std::size_t i = 0; i < count; i++) {
+    delta_x[i] = cos_degrees[i] / axis_lengths_[0];
+    delta_y[i] = sin_degrees[i] / axis_lengths_[1];
+  }
+  FastMath::Atan2(delta_y, delta_x, degrees, count);
+  FastMath::SinCos(degrees, sin_degrees, cos_degrees, count);
 
-  float error =
-      sqrt((ideal_x - x) * (ideal_x - x) + (ideal_y - y) * (ideal_y - y));
+  for (std::size_t i = 0; i < count; i++) {
+    float ideal_x = cx_ + axis_lengths_[0] * cos_degrees[i] * cos_angle_ -
+                    axis_lengths_[1] * sin_degrees[i] * sin_angle_;
+    float ideal_y = cy_ + axis_lengths_[0] * cos_degrees[i] * sin_angle_ +
+                    axis_lengths_[1] * sin_degrees[i] * cos_angle_;
 
-  return error;
+    errors[i] = sqrt((ideal_x - x[i]) * (ideal_x - x[i]) +
+                     (ideal_y - y[i]) * (ideal_y - y[i]));
+  }
 }
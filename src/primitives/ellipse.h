@@ -8,6 +8,9 @@
 #include "line.h"
 
 class Ellipse {
+ public:
+  static const std::size_t kErrorBatchSize = 64;
+
  public:
   Ellipse(float a, float b, float c, float d, float e, float f,
           float fitting_error);
@@ -16,7 +19,13 @@ class Ellipse {
   float get_circumference() const;
   PositionF get_center() const;
   Position get_positionAt(float degree) const;
+  PositionF get_tangentAt(float degree) const;
   float fitting_error() { return fitting_error_; }
+  float ComputeError(Position position) const;
+  // Errors of up to kErrorBatchSize edgels, through the batched FastMath
+  // calls.
+  void ComputeError(const Edgel *edgels, std::size_t count,
+                    float *errors) const;
   void Draw(cv::Mat &image, cv::Scalar color) const;
 
   float angle() const;
@@ -25,10 +34,7 @@ class Ellipse {
 
  public:
   static Ellipse FitFromEdgeSegment(const EdgeSegment &edge_segment);
-  static Ellipse FitFromLines(const std::vector<Line> &lines);
-
- protected:
-  float ComputeError(Position position);
+  static Ellipse FitFromLines(const Line *first, const Line *last);
 
  protected:
   float parameters_[6] = {0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f};
@@ -3,6 +3,8 @@
 #include <algorithm>
 #include <opencv2/imgproc.hpp>
 
+#include "line_fitter.h"
+
 Line::Line(float a, float b, float fitting_error, bool is_parameter_of_x,
            EdgeSegment edge_segment) {
   parameters_[0] = a;
@@ -67,7 +69,7 @@ float Line::get_angle() const {
   }
 }
 
-EdgeSegment Line::edge_segment() const { return edge_segment_; }
+const EdgeSegment& Line::edge_segment() const { return edge_segment_; }
 
 void Line::Draw(cv::Mat& image, cv::Scalar color) const {
   Position b = begin();
@@ -77,44 +79,8 @@ void Line::Draw(cv::Mat& image, cv::Scalar color) const {
 }
 
 Line Line::FitFromEdgeSegment(const EdgeSegment& edge_segment) {
-  float sum_xx = 0.0f;
-  float sum_yy = 0.0f;
-  float sum_xy = 0.0f;
-  float sum_x = 0.0f;
-  float sum_y = 0.0f;
-  float n = float(edge_segment.size());
-
-  for (const auto& s : edge_segment) {
-    sum_xx += float(s.position.x * s.position.x);
-    sum_yy += float(s.position.y * s.position.y);
-    sum_xy += float(s.position.x * s.position.y);
-    sum_x += float(s.position.x);
-    sum_y += float(s.position.y);
-  }
-
-  float inv_denominator_by_x = (sum_xx * n) - (sum_x * sum_x);
-  float inv_denominator_by_y = (sum_yy * n) - (sum_y * sum_y);
-
-  bool is_parameter_of_x = true;
-  float a = 0.0f;
-  float b = 0.0f;
-
-  if (inv_denominator_by_x >= inv_denominator_by_y) {
-    is_parameter_of_x = true;
-
-    a = ((n * sum_xy) + (-sum_x * sum_y)) / inv_denominator_by_x;
-    b = ((-sum_x * sum_xy) + (sum_xx * sum_y)) / inv_denominator_by_x;
-  } else {
-    is_parameter_of_x = false;
-
-    a = ((n * sum_xy) + (-sum_y * sum_x)) / inv_denominator_by_y;
-    b = ((-sum_y * sum_xy) + (sum_yy * sum_x)) / inv_denominator_by_y;
-  }
-
-  Line line(a, b, 0.0f, is_parameter_of_x, edge_segment);
-
-  float error = line.ComputeError(edge_segment);
-  line.fitting_error_ = error;
+  LineFitter fitter;
+  fitter.Add(edge_segment.begin(), edge_segment.end());
 
-  return line;
+  return fitter.Fit(edge_segment);
 }
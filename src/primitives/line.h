@@ -22,7 +22,7 @@ class Line {
   float ComputeError(const Position& position);
   float fitting_error() { return fitting_error_; }
   float get_angle() const;
-  EdgeSegment edge_segment() const;
+  const EdgeSegment& edge_segment() const;
 
   void Draw(cv::Mat& image, cv::Scalar color) const;
 
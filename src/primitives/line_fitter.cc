@@ -0,0 +1,99 @@
+#include "line_fitter.h"
+
+#include <algorithm>
+#include <cmath>
+
+void LineFitter::Reset() {
+  count_ = 0;
+  sum_x_ = 0;
+  sum_y_ = 0;
+  sum_xx_ = 0;
+  sum_yy_ = 0;
+  sum_xy_ = 0;
+}
+
+void LineFitter::Add(const Position& position) {
+  std::int64_t x = position.x;
+  std::int64_t y = position.y;
+
+  count_++;
+  sum_x_ += x;
+  sum_y_ += y;
+  sum_xx_ += x * x;
+  sum_yy_ += y * y;
+  sum_xy_ += x * y;
+}
+
+void LineFitter::Remove(const Position& position) {
+  std::int64_t x = position.x;
+  std::int64_t y = position.y;
+
+  count_--;
+  sum_x_ -= x;
+  sum_y_ -= y;
+  sum_xx_ -= x * x;
+  sum_yy_ -= y * y;
+  sum_xy_ -= x * y;
+}
+
+void LineFitter::Add(const Edgel* first, const Edgel* last) {
+  for (auto edgel = first; edgel != last; ++edgel) {
+    Add(edgel->position);
+  }
+}
+
+float LineFitter::fitting_error() const {
+  float a = 0.0f;
+  float b = 0.0f;
+  float error = 0.0f;
+  bool is_parameter_of_x = true;
+
+  Solve(a, b, error, is_parameter_of_x);
+
+  return error;
+}
+
+Line LineFitter::Fit(const EdgeSegment& edge_segment) const {
+  float a = 0.0f;
+  float b = 0.0f;
+  float error = 0.0f;
+  bool is_parameter_of_x = true;
+
+  Solve(a, b, error, is_parameter_of_x);
+
+  return Line(a, b, error, is_parameter_of_x, edge_segment);
+}
+
+// The line is y = a * x + b when x has the larger spread and x = a * y + b
+// otherwise. With the moments scaled by n, the squared residual along the
+// dependent axis sums to (D_dd - a * D_xy) / n, and dividing by 1 + a^2
+// turns it into the perpendicular one.
+void LineFitter::Solve(float& a, float& b, float& error,
+                       bool& is_parameter_of_x) const {
+  if (count_ == 0) {
+    return;
+  }
+
+  double n = double(count_);
+  double d_xx = double(count_ * sum_xx_ - sum_x_ * sum_x_);
+  double d_yy = double(count_ * sum_yy_ - sum_y_ * sum_y_);
+  double d_xy = double(count_ * sum_xy_ - sum_x_ * sum_y_);
+
+  is_parameter_of_x = d_xx >= d_yy;
+
+  double d_independent = is_parameter_of_x == true ? d_xx : d_yy;
+  double d_dependent = is_parameter_of_x == true ? d_yy : d_xx;
+  double sum_independent = double(is_parameter_of_x == true ? sum_x_ : sum_y_);
+  double sum_dependent = double(is_parameter_of_x == true ? sum_y_ : sum_x_);
+
+  double slope = 0.0;
+  if (d_independent > 0.0) {
+    slope = d_xy / d_independent;
+  }
+
+  double residual = std::max(d_dependent - slope * d_xy, 0.0);
+
+  a = float(slope);
+  b = float((sum_dependent - slope * sum_independent) / n);
+  error = float(std::sqrt(residual / (n * n * (1.0 + slope * slope))));
+}
@@ -0,0 +1,40 @@
+#ifndef PRIMITIVES__LINE_FITTER_H_
+#define PRIMITIVES__LINE_FITTER_H_
+
+#include <cstdint>
+
+#include "../types.h"
+#include "edge_segment.h"
+#include "line.h"
+
+// Least-squares line over a run of edgels kept as running moments, so points
+// enter and leave the run in O(1). The sums are exact integers, and the fit
+// and its error are solved from the centred second moments without another
+// pass over the pixels. The error is the RMS perpendicular distance.
+class LineFitter {
+ public:
+  void Reset();
+  void Add(const Position& position);
+  void Remove(const Position& position);
+  void Add(const Edgel* first, const Edgel* last);
+
+  std::int64_t count() const { return count_; }
+  float fitting_error() const;
+
+  // The line through the accumulated points, spanning edge_segment, which
+  // must hold exactly those points.
+  Line Fit(const EdgeSegment& edge_segment) const;
+
+ protected:
+  void Solve(float& a, float& b, float& error, bool& is_parameter_of_x) const;
+
+ protected:
+  std::int64_t count_ = 0;
+  std::int64_t sum_x_ = 0;
+  std::int64_t sum_y_ = 0;
+  std::int64_t sum_xx_ = 0;
+  std::int64_t sum_yy_ = 0;
+  std::int64_t sum_xy_ = 0;
+};
+
+#endif
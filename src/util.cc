@@ -4,22 +4,32 @@
 
 std::chrono::system_clock::time_point Util::start_time_;
 
-cv::Mat Util::toMat(GrayImage &image) {
+cv::Mat Util::toMat(GrayImageView image) {
   return cv::Mat(cv::Size(image.width(), image.height()), CV_8UC1,
-                 (void *)image.buffer())
-      .clone();
+                 (void *)image.buffer(), image.stride());
 }
 
-GrayImage Util::FromMat(cv::Mat &cv_image) {
+GrayImageView Util::ViewOf(cv::Mat &cv_image) {
   if (cv_image.type() != CV_8UC1) {
     throw std::invalid_argument("Input image should have the type of CV_8UC1.");
   }
 
   std::size_t width = cv_image.cols;
   std::size_t height = cv_image.rows;
-  unsigned char *buffer = cv_image.data;
+  std::size_t stride = cv_image.step;
+
+  return GrayImageView(cv_image.data, width, height, stride);
+}
+
+GrayImage Util::FromMat(cv::Mat &cv_image) {
+  GrayImageView view = ViewOf(cv_image);
+
+  GrayImage image(view.width(), view.height());
+  for (std::size_t y = 0; y < view.height(); ++y) {
+    std::copy(view.row(y), view.row(y) + view.width(), image.row(y));
+  }
 
-  return GrayImage(width, height, buffer);
+  return image;
 }
 
 void Util::StopwatchStart() {
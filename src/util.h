@@ -17,7 +17,10 @@
 
 class Util {
  public:
-  static cv::Mat toMat(GrayImage &image);
+  // toMat and ViewOf share pixels with their argument instead of copying;
+  // the result is only valid while the source buffer is alive.
+  static cv::Mat toMat(GrayImageView image);
+  static GrayImageView ViewOf(cv::Mat &cv_image);
   static GrayImage FromMat(cv::Mat &cv_image);
 
   static void StopwatchStart();
@@ -0,0 +1,93 @@
+#include "worker_pool.h"
+
+WorkerPool::~WorkerPool() { Stop(); }
+
+void WorkerPool::set_worker_count(std::size_t worker_count) {
+  if (worker_count == threads_.size()) {
+    return;
+  }
+
+  Stop();
+
+  // Workers start from the current generation, or they would take the last
+  // dispatch for a new one and finish it a second time.
+  std::uint64_t generation = 0;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = false;
+    generation = generation_;
+  }
+
+  threads_.reserve(worker_count);
+  for (std::size_t i = 0; i < worker_count; ++i) {
+    threads_.emplace_back(&WorkerPool::WorkerLoop, this, generation);
+  }
+}
+
+void WorkerPool::Dispatch(std::size_t task_count, TaskFunction function,
+                          void* task) {
+  if (threads_.empty() == true || task_count <= 1) {
+    for (std::size_t i = 0; i < task_count; ++i) {
+      function(task, i);
+    }
+    return;
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    function_ = function;
+    task_ = task;
+    task_count_ = task_count;
+    next_task_ = 0;
+    busy_workers_ = threads_.size();
+    generation_++;
+  }
+  work_ready_.notify_all();
+
+  RunTasks();
+
+  std::unique_lock<std::mutex> lock(mutex_);
+  work_done_.wait(lock, [this]() { return busy_workers_ == 0; });
+}
+
+void WorkerPool::RunTasks() {
+  for (std::size_t i = next_task_++; i < task_count_; i = next_task_++) {
+    function_(task_, i);
+  }
+}
+
+void WorkerPool::WorkerLoop(std::uint64_t seen_generation) {
+  while (true) {
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      work_ready_.wait(lock, [&]() {
+        return stopping_ == true || generation_ != seen_generation;
+      });
+
+      if (stopping_ == true) {
+        return;
+      }
+      seen_generation = generation_;
+    }
+
+    RunTasks();
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (--busy_workers_ == 0) {
+      work_done_.notify_one();
+    }
+  }
+}
+
+void WorkerPool::Stop() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  work_ready_.notify_all();
+
+  for (auto& thread : threads_) {
+    thread.join();
+  }
+  threads_.clear();
+}
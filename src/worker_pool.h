@@ -0,0 +1,67 @@
+#ifndef WORKER_POOL_H_
+#define WORKER_POOL_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Threads kept alive across frames to run indexed tasks. Run hands the tasks
+// out to the workers and the calling thread, and returns when all of them
+// are done; nothing is allocated per call.
+class WorkerPool {
+ public:
+  WorkerPool() = default;
+  WorkerPool(const WorkerPool&) = delete;
+  WorkerPool& operator=(const WorkerPool&) = delete;
+  ~WorkerPool();
+
+ public:
+  // Threads besides the caller; they are started or stopped here.
+  void set_worker_count(std::size_t worker_count);
+  std::size_t worker_count() const { return threads_.size(); }
+
+  // Calls task(i) for every i in [0, task_count).
+  template <typename Task>
+  void Run(std::size_t task_count, Task& task);
+
+ protected:
+  typedef void (*TaskFunction)(void* task, std::size_t index);
+
+  template <typename Task>
+  static void Invoke(void* task, std::size_t index);
+
+  void Dispatch(std::size_t task_count, TaskFunction function, void* task);
+  void RunTasks();
+  void WorkerLoop(std::uint64_t seen_generation);
+  void Stop();
+
+ protected:
+  std::vector<std::thread> threads_;
+  std::mutex mutex_;
+  std::condition_variable work_ready_;
+  std::condition_variable work_done_;
+  std::uint64_t generation_ = 0;
+  std::size_t busy_workers_ = 0;
+  bool stopping_ = false;
+
+  TaskFunction function_ = nullptr;
+  void* task_ = nullptr;
+  std::size_t task_count_ = 0;
+  std::atomic<std::size_t> next_task_{0};
+};
+
+template <typename Task>
+void WorkerPool::Run(std::size_t task_count, Task& task) {
+  Dispatch(task_count, &WorkerPool::Invoke<Task>, &task);
+}
+
+template <typename Task>
+void WorkerPool::Invoke(void* task, std::size_t index) {
+  (*static_cast<Task*>(task))(index);
+}
+
+#endif